@@ -24,9 +24,34 @@ int main(int argc, char** argv)
 
     bool issurfacing = false;
 
+    bool isoutofcore = false;
+    string outofcore_dir;
+
+    bool isloadmodel = false;
+
+    int n_cache_line = 0;
+
+    bool ismixedprecision = false;
+
+    bool isadaptive = false;
+
+    bool isstreaming = false;
+
+    int n_progressivelevels = 0;
+
+    bool ismarchingcubes = false;
+
+    double data_distance = 0;
+
+    bool isgradientmagnitude = false;
+
+    string insertfilename;
+
+    int n_outliers = 0;
+
     int c;
     optind=1;
-    while ((c = getopt(argc, argv, "i:o:l:s:")) != -1) {
+    while ((c = getopt(argc, argv, "i:o:l:s:m:f:c:pabr:td:gn:x:")) != -1) {
         switch (c) {
         case 'i':
             infilename = optarg;
@@ -41,6 +66,44 @@ int main(int argc, char** argv)
             issurfacing = true;
             n_voxel_line = atoi(optarg);
             break;
+        case 'm':
+            isoutofcore = true;
+            outofcore_dir = string(optarg);
+            break;
+        case 'f':
+            isloadmodel = true;
+            infilename = optarg;
+            break;
+        case 'c':
+            n_cache_line = atoi(optarg);
+            break;
+        case 'p':
+            ismixedprecision = true;
+            break;
+        case 'a':
+            isadaptive = true;
+            break;
+        case 'b':
+            isstreaming = true;
+            break;
+        case 'r':
+            n_progressivelevels = atoi(optarg);
+            break;
+        case 't':
+            ismarchingcubes = true;
+            break;
+        case 'd':
+            data_distance = atof(optarg);
+            break;
+        case 'g':
+            isgradientmagnitude = true;
+            break;
+        case 'n':
+            insertfilename = optarg;
+            break;
+        case 'x':
+            n_outliers = atoi(optarg);
+            break;
         case '?':
             cout << "Bad argument setting!" << endl;
             break;
@@ -56,24 +119,72 @@ int main(int argc, char** argv)
     cout<<"is surfacing: "<<issurfacing<<endl;
 
     cout<<"number of voxel per D: "<<n_voxel_line<<endl;
+    if(isoutofcore)cout<<"out-of-core folder: "<<outofcore_dir<<endl;
 
 
     vector<double>Vs;
     RBF_Core rbf_core;
     RBF_Paras para = Set_RBF_PARA();
     para.user_lamnbda = user_lambda;
+    para.isoutofcore = isoutofcore;
+    para.outofcore_dir = outofcore_dir;
+
+    if(isloadmodel){
+        if(!rbf_core.Read_Model(infilename))return 1;
+    }else{
+        readXYZ(infilename,Vs);
+        rbf_core.InjectData(Vs,para);
+        if(!rbf_core.BuildK(para) || !rbf_core.InitNormal(para) || !rbf_core.OptNormal(0)){
+            cout<<"solve failed"<<endl;
+            return 1;
+        }
+
+        if(!insertfilename.empty()){
+            vector<double>newVs;
+            readXYZ(insertfilename,newVs);
+            if(!rbf_core.InsertPoints(newVs)){
+                cout<<"insert failed"<<endl;
+                return 1;
+            }
+            //O(N^3), only on small inputs
+            if(rbf_core.npt<=1000)rbf_core.Check_InverseBlocks();
+            if(!rbf_core.OptNormal(0)){
+                cout<<"solve failed"<<endl;
+                return 1;
+            }
+        }
 
-    readXYZ(infilename,Vs);
-    rbf_core.InjectData(Vs,para);
-    rbf_core.BuildK(para);
-    rbf_core.InitNormal(para);
-    rbf_core.OptNormal(0);
+        if(n_outliers>0){
+            //O(N^3) per refit, only on small inputs
+            if(rbf_core.npt<=300)rbf_core.Check_LeaveOneOut(5);
+            if(!rbf_core.RemoveOutliers(n_outliers)){
+                cout<<"outlier removal failed"<<endl;
+                return 1;
+            }
+            if(!rbf_core.OptNormal(0)){
+                cout<<"solve failed"<<endl;
+                return 1;
+            }
+        }
+
+        rbf_core.Write_Hermite_NormalPrediction(outpath+pcname+"_normal", 1);
+        rbf_core.Write_Model(outpath+pcname+"_model.vipss");
+    }
 
-    rbf_core.Write_Hermite_NormalPrediction(outpath+pcname+"_normal", 1);
+    if(ismixedprecision)rbf_core.Set_MixedPrecision(true);
+    if(n_cache_line>0)rbf_core.Build_FieldCache(n_cache_line);
 
     if(issurfacing){
+        rbf_core.Release_SolverMatrices();
+        rbf_core.isadaptivesurfacing = isadaptive;
+        rbf_core.ismarchingcubes = ismarchingcubes;
+        rbf_core.surfacing_datadistance = data_distance;
+        rbf_core.issurfacinggradient = isgradientmagnitude;
+        if(isstreaming)rbf_core.streamsurfacing_fname = outpath+pcname+"_surface";
+        rbf_core.n_progressivelevels = n_progressivelevels;
+        rbf_core.progressivesurfacing_fname = outpath+pcname+"_surface";
         rbf_core.Surfacing(0,n_voxel_line);
-        rbf_core.Write_Surface(outpath+pcname+"_surface");
+        if(!isstreaming)rbf_core.Write_Surface(outpath+pcname+"_surface");
     }
 
 
@@ -0,0 +1,156 @@
+#include "fieldcache.h"
+#include "Polygonizer.h"
+#include <iostream>
+#include <chrono>
+#include <cmath>
+#include <algorithm>
+
+typedef std::chrono::high_resolution_clock Clock;
+
+
+FieldCache::FieldCache():h(0){
+    origin[0] = origin[1] = origin[2] = 0;
+}
+
+void FieldCache::Locate(const double *p, long long bijk[3], double local[3]) const{
+
+    for(int j=0;j<3;++j){
+        double q = (p[j]-origin[j])/h;
+        bijk[j] = (long long)floor(q/brick);
+        local[j] = q - bijk[j]*brick;
+    }
+}
+
+double FieldCache::Interpolate(const double *bs, const double local[3]) const{
+
+    //cubic Lagrange weights on the nodes -1, 0, 1, 2 of the cell
+    double w[3][4];
+    int c[3];
+    for(int j=0;j<3;++j){
+        c[j] = min(max(int(local[j]),0),brick-1);
+        double t = local[j]-c[j];
+        w[j][0] = -t*(t-1)*(t-2)/6;
+        w[j][1] = (t+1)*(t-1)*(t-2)/2;
+        w[j][2] = -(t+1)*t*(t-2)/2;
+        w[j][3] = (t+1)*t*(t-1)/6;
+    }
+
+    //sample u of the brick is lattice node u-1, so the stencil starts at u = c
+    double re = 0;
+    for(int a=0;a<4;++a){
+        const double *row = bs + ((c[2]+a)*bside + c[1])*bside + c[0];
+        double ry = 0;
+        for(int b=0;b<4;++b){
+            const double *s = row + b*bside;
+            ry += w[1][b] * (w[0][0]*s[0] + w[0][1]*s[1] + w[0][2]*s[2] + w[0][3]*s[3]);
+        }
+        re += w[2][a] * ry;
+    }
+    return re;
+}
+
+void FieldCache::Build(const HermiteField &field, const vector<double>&pts, double h, int band, double postol){
+
+    Clear();
+    if(!field.IsValid() || h<=0)return;
+
+    auto t1 = Clock::now();
+
+    this->h = h;
+    for(int j=0;j<3;++j)origin[j] = field.bbox[j];
+
+    //bricks around the points
+    vector<long long>bijk_list;
+    unordered_map<long long, int>mp_all;
+    size_t n = pts.size()/3;
+    for(size_t i=0;i<n;++i){
+        long long bijk[3];
+        double local[3];
+        Locate(pts.data()+i*3, bijk, local);
+        for(int dk=-band;dk<=band;++dk)for(int dj=-band;dj<=band;++dj)for(int di=-band;di<=band;++di){
+            long long key = latticekey(bijk[0]+di, bijk[1]+dj, bijk[2]+dk);
+            if(mp_all.find(key)!=mp_all.end())continue;
+            mp_all[key] = bijk_list.size()/3;
+            bijk_list.push_back(bijk[0]+di);
+            bijk_list.push_back(bijk[1]+dj);
+            bijk_list.push_back(bijk[2]+dk);
+        }
+    }
+
+    const long nslot = bijk_list.size()/3;
+    const size_t bsize3 = bside*bside*bside;
+    vector<double>all_samples(nslot*bsize3);
+    vector<double>all_bound(nslot);
+    vector<char>iskeep(nslot);
+
+    #pragma omp parallel for schedule(dynamic)
+    for(long s=0;s<nslot;++s){
+        const long long *bijk = bijk_list.data()+s*3;
+        double *bs = all_samples.data()+s*bsize3;
+        double p[3];
+        for(int w=0;w<bside;++w)for(int v=0;v<bside;++v)for(int u=0;u<bside;++u){
+            p[0] = origin[0] + (bijk[0]*brick + u-1)*h;
+            p[1] = origin[1] + (bijk[1]*brick + v-1)*h;
+            p[2] = origin[2] + (bijk[2]*brick + w-1)*h;
+            bs[(w*bside+v)*bside+u] = field.Value(p);
+        }
+
+        //cell centers are where the interpolant is least accurate
+        double maxerr = 0, mingrad = 1e300, grad[3], local[3];
+        for(int a=0;a<brick;++a)for(int b=0;b<brick;++b)for(int c=0;c<brick;++c){
+            local[0] = a+0.5; local[1] = b+0.5; local[2] = c+0.5;
+            for(int j=0;j<3;++j)p[j] = origin[j] + (bijk[j]*brick + local[j])*h;
+            double exact = field.ValueAndGradient(p, grad);
+            maxerr = max(maxerr, fabs(Interpolate(bs, local)-exact));
+            mingrad = min(mingrad, sqrt(grad[0]*grad[0]+grad[1]*grad[1]+grad[2]*grad[2]));
+        }
+        //a factor 4 over the probed error as an estimate (not a bound: the error
+        //between the probes is not controlled); keep only bricks whose estimate
+        //shifts the zero level set by less than postol
+        all_bound[s] = 4*maxerr;
+        iskeep[s] = all_bound[s] <= postol*mingrad;
+    }
+
+    long nkeep = 0;
+    for(long s=0;s<nslot;++s)if(iskeep[s]){
+        const long long *bijk = bijk_list.data()+s*3;
+        mp_brick[latticekey(bijk[0],bijk[1],bijk[2])] = nkeep;
+        if(nkeep!=s)copy(all_samples.begin()+s*bsize3, all_samples.begin()+(s+1)*bsize3, all_samples.begin()+nkeep*bsize3);
+        all_bound[nkeep] = all_bound[s];
+        ++nkeep;
+    }
+    all_samples.resize(nkeep*bsize3);
+    all_samples.shrink_to_fit();
+    all_bound.resize(nkeep);
+    samples.swap(all_samples);
+    bound.swap(all_bound);
+
+    cout<<"FieldCache: h = "<<h<<", "<<nkeep<<" / "<<nslot<<" bricks kept, "<<MemoryBytes()/1e6<<" MB, "
+       <<std::chrono::nanoseconds(Clock::now() - t1).count()/1e9<<" s"<<endl;
+}
+
+void FieldCache::Clear(){
+
+    mp_brick.clear();
+    vector<double>().swap(samples);
+    vector<double>().swap(bound);
+}
+
+bool FieldCache::Value(const double *p, double &val, double &err) const{
+
+    long long bijk[3];
+    double local[3];
+    Locate(p, bijk, local);
+    auto it = mp_brick.find(latticekey(bijk[0],bijk[1],bijk[2]));
+    if(it==mp_brick.end())return false;
+
+    val = Interpolate(samples.data() + size_t(it->second)*bside*bside*bside, local);
+    err = bound[it->second];
+    return true;
+}
+
+bool FieldCache::Value(const double *p, double &val) const{
+
+    double err;
+    return Value(p, val, err);
+}
@@ -0,0 +1,62 @@
+#ifndef FIELDCACHE_H
+#define FIELDCACHE_H
+
+
+#include <vector>
+#include <unordered_map>
+#include "hermitefield.h"
+using namespace std;
+
+
+/* Narrow-band cache of a HermiteField on a regular lattice of spacing h.
+ * The lattice is stored as sparse bricks of 8^3 cells, allocated only around
+ * the input points (the surface passes through them). Each brick keeps its
+ * own copy of the 1-sample low / 2-sample high apron, so a tricubic (cubic
+ * Lagrange) lookup never leaves the brick.
+ * After filling, every brick is checked against the exact field at its cell
+ * centers and bricks whose estimated error would move the zero level set by
+ * more than postol are dropped. The estimate is a sampled one (a factor over
+ * the largest probed error), not a guaranteed bound: a cached value can be
+ * off by more between the probes, and its sign is not certified. Value()
+ * reports a miss outside the kept bricks and the caller evaluates itself. */
+class FieldCache{
+
+public:
+
+    static const int brick = 8;                 // cells per brick side
+    static const int bside = brick + 3;         // samples per brick side, with apron
+
+    double h;
+    double origin[3];
+
+private:
+
+    unordered_map<long long, int>mp_brick;      // packed brick ijk -> slot
+    vector<double>samples;                      // bside^3 per slot
+    vector<double>bound;                        // error estimate per slot
+
+public:
+
+    FieldCache();
+
+    // bricks within band bricks of each point; postol: allowed zero-set shift
+    void Build(const HermiteField &field, const vector<double>&pts, double h, int band, double postol);
+    void Clear();
+
+    bool IsValid() const { return !mp_brick.empty(); }
+    size_t MemoryBytes() const { return samples.size() * sizeof(double); }
+
+    // false if p lies outside the cached band
+    bool Value(const double *p, double &val) const;
+    bool Value(const double *p, double &val, double &err) const;  // err: the brick's error estimate
+
+private:
+
+    // brick coordinates of p and its position inside that brick, in cells
+    void Locate(const double *p, long long bijk[3], double local[3]) const;
+    double Interpolate(const double *brick_samples, const double local[3]) const;
+
+};
+
+
+#endif // FIELDCACHE_H
@@ -0,0 +1,335 @@
+#include "hermitefield.h"
+#include "kernelbatch.h"
+#include <iostream>
+#include <fstream>
+#include <algorithm>
+#include <cstring>
+#include <cmath>
+#include <stdint.h>
+#include <climits>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+
+/* model file: this header, zero padding up to data_offset, then the 7N
+ * doubles of the SoA block. Native (little-endian) byte order. */
+static const char hf_magic[8] = {'V','I','P','S','S','H','F','\0'};
+static const uint32_t hf_version = 1;
+static const int32_t hf_kernel_xcube = 0;      // RBF_Kernal::XCube
+static const uint64_t hf_data_offset = 256;
+
+struct HermiteFieldFileHeader{
+    char magic[8];
+    uint32_t version;
+    int32_t kernel;
+    int32_t polyDeg;
+    int32_t bsize;
+    uint64_t npt;
+    double bbox[6];
+    double b[10];
+    uint64_t data_offset;
+};
+
+
+HermiteField::HermiteField():npt(0),polyDeg(1),bsize(0),p_data(NULL),p_map(NULL),map_bytes(0){}
+
+HermiteField::~HermiteField(){
+    Clear();
+}
+
+void HermiteField::Set(const vector<double>&pts, const double *a, const double *b, int polyDeg){
+
+    npt = pts.size()/3;
+    this->polyDeg = polyDeg;
+    bsize = polyDeg==2 ? 10 : 4;
+    memcpy(this->b, b, bsize*sizeof(double));
+
+    data.resize(size_t(npt)*7);
+    double *p = data.data();
+    for(int i=0;i<npt;++i)
+        for(int j=0;j<3;++j)p[j*npt+i] = pts[i*3+j];
+    memcpy(p+size_t(npt)*3, a, size_t(npt)*4*sizeof(double));
+
+    for(int j=0;j<3;++j){
+        bbox[j] = npt ? *min_element(p+j*npt, p+(j+1)*npt) : 0;
+        bbox[j+3] = npt ? *max_element(p+j*npt, p+(j+1)*npt) : 0;
+    }
+
+    if(p_map!=NULL){munmap(p_map, map_bytes);p_map = NULL;}
+    p_data = p;
+    vector<float>().swap(data_f);
+}
+
+void HermiteField::Clear(){
+
+    vector<double>().swap(data);
+    vector<float>().swap(data_f);
+    if(p_map!=NULL)munmap(p_map, map_bytes);
+    p_map = NULL;
+    map_bytes = 0;
+    p_data = NULL;
+    npt = 0;
+}
+
+bool HermiteField::Save(string fname) const{
+
+    if(!IsValid())return false;
+
+    HermiteFieldFileHeader head;
+    memset(&head, 0, sizeof(head));
+    memcpy(head.magic, hf_magic, 8);
+    head.version = hf_version;
+    head.kernel = hf_kernel_xcube;
+    head.polyDeg = polyDeg;
+    head.bsize = bsize;
+    head.npt = npt;
+    memcpy(head.bbox, bbox, sizeof(bbox));
+    memcpy(head.b, b, bsize*sizeof(double));
+    head.data_offset = hf_data_offset;
+
+    ofstream fout(fname, ios::binary);
+    if(fout.fail()){
+        cout<<"HermiteField: can not write "<<fname<<endl;
+        return false;
+    }
+    vector<char>pad(hf_data_offset - sizeof(head), 0);
+    fout.write((const char*)&head, sizeof(head));
+    fout.write(pad.data(), pad.size());
+    fout.write((const char*)p_data, MemoryBytes());
+    fout.close();
+    if(fout.fail()){
+        cout<<"HermiteField: write error on "<<fname<<endl;
+        return false;
+    }
+
+    cout<<"HermiteField: saved "<<npt<<" centers to "<<fname<<endl;
+    return true;
+}
+
+bool HermiteField::Load(string fname){
+
+    Clear();
+
+    int fd = open(fname.c_str(), O_RDONLY);
+    if(fd<0){
+        cout<<"HermiteField: can not open "<<fname<<endl;
+        return false;
+    }
+    struct stat st;
+    if(fstat(fd, &st)!=0 || size_t(st.st_size) < sizeof(HermiteFieldFileHeader)){
+        cout<<"HermiteField: "<<fname<<" is not a model file"<<endl;
+        close(fd);
+        return false;
+    }
+
+    size_t nbytes = st.st_size;
+    void *ptr = mmap(NULL, nbytes, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(ptr==MAP_FAILED){
+        cout<<"HermiteField: mmap failed on "<<fname<<endl;
+        return false;
+    }
+
+    const HermiteFieldFileHeader &head = *(const HermiteFieldFileHeader*)ptr;
+    string err;
+    if(memcmp(head.magic, hf_magic, 8)!=0)err = "bad magic";
+    else if(head.version!=hf_version)err = "unsupported version";
+    else if(head.kernel!=hf_kernel_xcube)err = "unsupported kernel";
+    else if(!(head.polyDeg==1 && head.bsize==4) && !(head.polyDeg==2 && head.bsize==10))err = "bad polynomial degree";
+    else if(head.data_offset%sizeof(double)!=0 || head.data_offset > nbytes)err = "bad data offset";
+    else if(head.npt > (nbytes - head.data_offset)/(7*sizeof(double)))err = "truncated file";
+    else if(head.npt > uint64_t(INT_MAX))err = "too many centers";
+    if(!err.empty()){
+        cout<<"HermiteField: "<<fname<<": "<<err<<endl;
+        munmap(ptr, nbytes);
+        return false;
+    }
+
+    npt = head.npt;
+    polyDeg = head.polyDeg;
+    bsize = head.bsize;
+    memcpy(bbox, head.bbox, sizeof(bbox));
+    memcpy(b, head.b, bsize*sizeof(double));
+
+    p_map = ptr;
+    map_bytes = nbytes;
+    p_data = (const double*)((const char*)ptr + head.data_offset);
+
+    //evaluation walks all streams sequentially for every query
+    madvise(ptr, nbytes, MADV_WILLNEED);
+
+    cout<<"HermiteField: mapped "<<npt<<" centers from "<<fname<<endl;
+    return true;
+}
+
+double HermiteField::Poly_Value(const double *p) const{
+
+    if(polyDeg==2){
+        double buf[4] = {1, p[0], p[1], p[2]};
+        double re = 0;
+        int ind = 0;
+        for(int j=0;j<4;++j)for(int k=j;k<4;++k)re += b[ind++] * buf[j] * buf[k];
+        return re;
+    }
+    return b[0] + b[1]*p[0] + b[2]*p[1] + b[3]*p[2];
+}
+
+void HermiteField::Poly_Gradient(const double *p, double *grad) const{
+
+    if(polyDeg==2){
+        double buf[4] = {1, p[0], p[1], p[2]};
+        int ind = 0;
+        for(int i=0;i<3;++i)grad[i] = 0;
+        for(int j=0;j<4;++j)for(int k=j;k<4;++k){
+            if(j>0)grad[j-1] += b[ind] * buf[k];
+            if(k>0)grad[k-1] += b[ind] * buf[j];
+            ++ind;
+        }
+        return;
+    }
+    for(int i=0;i<3;++i)grad[i] = b[i+1];
+}
+
+double HermiteField::Value(const double *p) const{
+
+    const double *S[7];
+    for(int k=0;k<7;++k)S[k] = Stream(k);
+    return XCube_Hermite_Value(p, S, npt) + Poly_Value(p);
+}
+
+double HermiteField::ValueAndGradient(const double *p, double *grad) const{
+
+    const double *S[7];
+    for(int k=0;k<7;++k)S[k] = Stream(k);
+    double re = XCube_Hermite_ValueGradient(p, S, npt, grad);
+
+    double pgrad[3];
+    Poly_Gradient(p,pgrad);
+    for(int j=0;j<3;++j)grad[j] += pgrad[j];
+
+    return re + Poly_Value(p);
+}
+
+void HermiteField::Gradient(const double *p, double *grad) const{
+
+    ValueAndGradient(p,grad);
+}
+
+void HermiteField::Value_Batch(const double *p, size_t m, double *out) const{
+
+    const long n = m;
+    #pragma omp parallel for schedule(dynamic,16)
+    for(long i=0;i<n;++i)out[i] = Value(p+i*3);
+}
+
+void HermiteField::Set_SinglePrecision(bool on){
+
+    vector<float>().swap(data_f);
+    if(!on || !IsValid())return;
+
+    //centered at the bounding box so the float coordinates keep their digits
+    fextent = 0;
+    for(int j=0;j<3;++j){
+        fcenter[j] = (bbox[j]+bbox[j+3])/2;
+        fextent = max(fextent, (bbox[j+3]-bbox[j])/2);
+    }
+
+    data_f.resize(size_t(npt)*8);
+    float *pf = data_f.data();
+    for(int j=0;j<3;++j)
+        for(int i=0;i<npt;++i)pf[j*npt+i] = Stream(j)[i] - fcenter[j];
+    for(size_t i=size_t(npt)*3;i<size_t(npt)*7;++i)pf[i] = p_data[i];
+    for(int i=0;i<npt;++i){
+        double gx = Stream(4)[i], gy = Stream(5)[i], gz = Stream(6)[i];
+        //rounded up, it enters the error bound only
+        pf[size_t(npt)*7+i] = sqrt(gx*gx+gy*gy+gz*gz)*(1+1e-6);
+    }
+}
+
+double HermiteField::Value_SignCertified(const double *p) const{
+
+    if(data_f.empty())return Value(p);
+
+    const float *S[8];
+    for(int k=0;k<8;++k)S[k] = data_f.data() + size_t(k)*npt;
+
+    float pf[3];
+    double pmax = 0;
+    for(int j=0;j<3;++j){
+        pf[j] = p[j]-fcenter[j];
+        pmax = max(pmax, fabs(double(pf[j])));
+    }
+    //rounding of the query and of the centers, per coordinate u*|x|
+    const double u = 0.5*1.1920929e-7;
+    double delta = sqrt(3.)*u*(pmax+fextent)*(1+1e-6);
+
+    double err;
+    double re = XCube_Hermite_Value_F32(pf, S, npt, delta, &err) + Poly_Value(p);
+    if(fabs(re)>err)return re;
+    return Value(p);
+}
+
+double HermiteField::Taylor_Bound(const double *c, const double *half, double *val, double *grad, double *hess) const{
+
+    //bounds on the kernel derivatives: |D^3 r^3| <= 6, |D^4 r^3| <= 9/r, so
+    //the a-term has a Hessian Lipschitz constant of 6|a| and the g-term, g.grad(r^3),
+    //a Hessian bounded by 6|g| everywhere and Lipschitz by 9|g|/r away from x_i
+    const double delta = sqrt(half[0]*half[0]+half[1]*half[1]+half[2]*half[2]);
+    const double delta2 = delta*delta, delta3 = delta2*delta;
+    const double *X = Stream(0), *Y = Stream(1), *Z = Stream(2);
+    const double *A = Stream(3), *GX = Stream(4), *GY = Stream(5), *GZ = Stream(6);
+
+    //branch free, so that it vectorizes; a center at c itself adds nothing
+    double f = 0, gx = 0, gy = 0, gz = 0, rem = 0, mag = 0;
+    double hxx = 0, hyy = 0, hzz = 0, hxy = 0, hxz = 0, hyz = 0;
+    #pragma omp simd reduction(+:f,gx,gy,gz,rem,mag,hxx,hyy,hzz,hxy,hxz,hyz)
+    for(int i=0;i<npt;++i){
+        double dx = c[0]-X[i], dy = c[1]-Y[i], dz = c[2]-Z[i];
+        double a = A[i], ex = GX[i], ey = GY[i], ez = GZ[i];
+        double r2 = dx*dx+dy*dy+dz*dz;
+        double gn = sqrt(ex*ex+ey*ey+ez*ez);
+        double r = sqrt(r2);
+        double ir = r>0 ? 1/r : 0;
+        double rho = max(r - delta, 1e-300);
+        rem += fabs(a)*delta3 + min(6*gn*delta2, 1.5*gn*delta3/rho);
+        mag += fabs(a)*(r2*r + 3*r2*delta + 6*r*delta2) + gn*(3*r + 6*delta + 6*delta2*ir);
+
+        double dg = dx*ex+dy*ey+dz*ez;
+        f += r*(a*r2 + 3*dg);
+        double s1 = 3*a*r + 3*dg*ir;                    //gradient: s1*d + 3r*g
+        gx += s1*dx + 3*r*ex;
+        gy += s1*dy + 3*r*ey;
+        gz += s1*dz + 3*r*ez;
+        //Hessian: s1*I + s2*d d^T + 3/r (d g^T + g d^T)
+        double s2 = 3*a*ir - 3*dg*ir*ir*ir;
+        double t = 3*ir;
+        hxx += s1 + s2*dx*dx + 2*t*dx*ex;
+        hyy += s1 + s2*dy*dy + 2*t*dy*ey;
+        hzz += s1 + s2*dz*dz + 2*t*dz*ez;
+        hxy += s2*dx*dy + t*(dx*ey+dy*ex);
+        hxz += s2*dx*dz + t*(dx*ez+dz*ex);
+        hyz += s2*dy*dz + t*(dy*ez+dz*ey);
+    }
+    double g[3] = {gx, gy, gz};
+    double H[9] = {hxx, hxy, hxz, hxy, hyy, hyz, hxz, hyz, hzz};
+
+    double pgrad[3];
+    Poly_Gradient(c,pgrad);
+    for(int k=0;k<3;++k)g[k] += pgrad[k];
+    if(polyDeg==2){
+        int ind = 0;
+        for(int j=0;j<4;++j)for(int k=j;k<4;++k){
+            if(j>0)H[(j-1)*3+(k-1)] += b[ind];
+            if(j>0)H[(k-1)*3+(j-1)] += b[ind];
+            ++ind;
+        }
+    }
+    *val = f + Poly_Value(c);
+    for(int k=0;k<3;++k)grad[k] = g[k];
+    for(int k=0;k<9;++k)hess[k] = H[k];
+
+    //plus the rounding of the sums above, over the box
+    return rem*(1+1e-6) + (npt+16)*2.3e-16*mag;
+}
@@ -0,0 +1,90 @@
+#ifndef HERMITEFIELD_H
+#define HERMITEFIELD_H
+
+
+#include <vector>
+#include <string>
+#include <cstddef>
+using namespace std;
+
+
+/* Solved Hermite triharmonic field, detached from the solver:
+ *   f(p) = sum_i a_i |p-x_i|^3 + g_i . grad|p-x_i|^3 + poly(p)
+ * Only the centers and coefficients are kept, as one structure of arrays
+ * [x | y | z | a | gx | gy | gz] (7N doubles), plus the polynomial part.
+ * Every query is const and uses only stack scratch, so any number of
+ * threads can evaluate the same field at once.
+ * Save/Load use a versioned binary file whose payload is that same SoA
+ * block, so Load maps the file and evaluates straight from the page cache. */
+class HermiteField{
+
+public:
+
+    int npt;
+    int polyDeg;
+    int bsize;
+    double b[10];
+    double bbox[6];     // min x/y/z, max x/y/z of the centers
+
+private:
+
+    vector<double>data;
+    const double *p_data;
+
+    void *p_map;        // file mapping when loaded by Load
+    size_t map_bytes;
+
+    // single precision copy for Value_SignCertified: centered x, y, z, a, gx, gy, gz, |g|
+    vector<float>data_f;
+    double fcenter[3];
+    double fextent;
+
+public:
+
+    HermiteField();
+    ~HermiteField();
+
+    HermiteField(const HermiteField &) = delete;
+    HermiteField &operator=(const HermiteField &) = delete;
+
+    // pts: xyz interleaved; a: the 4N Hermite coefficients [a | gx | gy | gz] of RBF_Core
+    void Set(const vector<double>&pts, const double *a, const double *b, int polyDeg);
+    void Clear();
+
+    bool Save(string fname) const;
+    bool Load(string fname);
+
+    bool IsValid() const { return p_data != NULL; }
+    size_t MemoryBytes() const { return size_t(npt) * 7 * sizeof(double); }
+
+    // k-th stream of the SoA block: 0..2 center coordinates, 3 a, 4..6 g
+    const double *Stream(int k) const { return p_data + size_t(k) * npt; }
+
+public:
+
+    double Value(const double *p) const;
+    void Gradient(const double *p, double *grad) const;
+    double ValueAndGradient(const double *p, double *grad) const;
+
+    // m queries (xyz interleaved), multithreaded
+    void Value_Batch(const double *p, size_t m, double *out) const;
+
+    // float32 evaluation with a forward error bound; where |f| is within the
+    // bound the value is recomputed in double, so the sign is always exact
+    void Set_SinglePrecision(bool on);
+    bool HasSinglePrecision() const { return !data_f.empty(); }
+    double Value_SignCertified(const double *p) const;
+
+    // second order Taylor model at c: value, gradient and Hessian (row major);
+    // returns a bound on |f(c+d) - model(d)| over the box |d_j| <= half[j]
+    double Taylor_Bound(const double *c, const double *half, double *val, double *grad, double *hess) const;
+
+private:
+
+    double Poly_Value(const double *p) const;
+    void Poly_Gradient(const double *p, double *grad) const;
+
+};
+
+
+#endif // HERMITEFIELD_H
@@ -0,0 +1,311 @@
+#include "kernelbatch.h"
+#include <math.h>
+#include <algorithm>
+using std::min;
+
+#if defined(__AVX512F__) || defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+
+/* thin wrappers so the same loop body serves AVX-512 and AVX2 */
+#if defined(__AVX512F__)
+
+#define KB_WIDTH 8
+typedef __m512d kb_vec;
+static inline kb_vec kb_set1(double a){ return _mm512_set1_pd(a); }
+static inline kb_vec kb_load(const double *p){ return _mm512_loadu_pd(p); }
+static inline void kb_store(double *p, kb_vec a){ _mm512_storeu_pd(p,a); }
+static inline kb_vec kb_add(kb_vec a, kb_vec b){ return _mm512_add_pd(a,b); }
+static inline kb_vec kb_sub(kb_vec a, kb_vec b){ return _mm512_sub_pd(a,b); }
+static inline kb_vec kb_mul(kb_vec a, kb_vec b){ return _mm512_mul_pd(a,b); }
+static inline kb_vec kb_div(kb_vec a, kb_vec b){ return _mm512_div_pd(a,b); }
+static inline kb_vec kb_sqrt(kb_vec a){ return _mm512_sqrt_pd(a); }
+// a where r > eps, 0 elsewhere
+static inline kb_vec kb_mask_gt(kb_vec r, kb_vec eps, kb_vec a){
+    return _mm512_maskz_mov_pd(_mm512_cmp_pd_mask(r,eps,_CMP_GT_OQ),a);
+}
+static inline double kb_hsum(kb_vec a){ return _mm512_reduce_add_pd(a); }
+
+#elif defined(__AVX2__)
+
+#define KB_WIDTH 4
+typedef __m256d kb_vec;
+static inline kb_vec kb_set1(double a){ return _mm256_set1_pd(a); }
+static inline kb_vec kb_load(const double *p){ return _mm256_loadu_pd(p); }
+static inline void kb_store(double *p, kb_vec a){ _mm256_storeu_pd(p,a); }
+static inline kb_vec kb_add(kb_vec a, kb_vec b){ return _mm256_add_pd(a,b); }
+static inline kb_vec kb_sub(kb_vec a, kb_vec b){ return _mm256_sub_pd(a,b); }
+static inline kb_vec kb_mul(kb_vec a, kb_vec b){ return _mm256_mul_pd(a,b); }
+static inline kb_vec kb_div(kb_vec a, kb_vec b){ return _mm256_div_pd(a,b); }
+static inline kb_vec kb_sqrt(kb_vec a){ return _mm256_sqrt_pd(a); }
+static inline kb_vec kb_mask_gt(kb_vec r, kb_vec eps, kb_vec a){
+    return _mm256_and_pd(_mm256_cmp_pd(r,eps,_CMP_GT_OQ),a);
+}
+static inline double kb_hsum(kb_vec a){
+    __m128d s = _mm_add_pd(_mm256_castpd256_pd128(a),_mm256_extractf128_pd(a,1));
+    return _mm_cvtsd_f64(_mm_add_sd(s,_mm_unpackhi_pd(s,s)));
+}
+
+#endif
+
+
+/* the same for single precision; horizontal sums are returned in double */
+#if defined(__AVX512F__)
+
+#define KBF_WIDTH 16
+typedef __m512 kbf_vec;
+static inline kbf_vec kbf_set1(float a){ return _mm512_set1_ps(a); }
+static inline kbf_vec kbf_load(const float *p){ return _mm512_loadu_ps(p); }
+static inline kbf_vec kbf_add(kbf_vec a, kbf_vec b){ return _mm512_add_ps(a,b); }
+static inline kbf_vec kbf_sub(kbf_vec a, kbf_vec b){ return _mm512_sub_ps(a,b); }
+static inline kbf_vec kbf_mul(kbf_vec a, kbf_vec b){ return _mm512_mul_ps(a,b); }
+static inline kbf_vec kbf_sqrt(kbf_vec a){ return _mm512_sqrt_ps(a); }
+static inline kbf_vec kbf_abs(kbf_vec a){ return _mm512_abs_ps(a); }
+static inline double kbf_hsum(kbf_vec a){
+    __m256 hi = _mm256_castpd_ps(_mm512_extractf64x4_pd(_mm512_castps_pd(a),1));
+    return _mm512_reduce_add_pd(_mm512_add_pd(_mm512_cvtps_pd(_mm512_castps512_ps256(a)),_mm512_cvtps_pd(hi)));
+}
+
+#elif defined(__AVX2__)
+
+#define KBF_WIDTH 8
+typedef __m256 kbf_vec;
+static inline kbf_vec kbf_set1(float a){ return _mm256_set1_ps(a); }
+static inline kbf_vec kbf_load(const float *p){ return _mm256_loadu_ps(p); }
+static inline kbf_vec kbf_add(kbf_vec a, kbf_vec b){ return _mm256_add_ps(a,b); }
+static inline kbf_vec kbf_sub(kbf_vec a, kbf_vec b){ return _mm256_sub_ps(a,b); }
+static inline kbf_vec kbf_mul(kbf_vec a, kbf_vec b){ return _mm256_mul_ps(a,b); }
+static inline kbf_vec kbf_sqrt(kbf_vec a){ return _mm256_sqrt_ps(a); }
+static inline kbf_vec kbf_abs(kbf_vec a){ return _mm256_andnot_ps(_mm256_set1_ps(-0.f),a); }
+static inline double kbf_hsum(kbf_vec a){
+    return kb_hsum(_mm256_add_pd(_mm256_cvtps_pd(_mm256_castps256_ps128(a)),_mm256_cvtps_pd(_mm256_extractf128_ps(a,1))));
+}
+
+#endif
+
+static const double kb_eps = 1e-8;   // same cutoff as XCube_Hessian_Kernel_2p
+
+
+void XCube_FG_Kernel_Batch(const double *p, const double *xs, const double *ys, const double *zs, int n,
+                           double *F, double *const G[3]){
+
+    int i = 0;
+#ifdef KB_WIDTH
+    const kb_vec px = kb_set1(p[0]), py = kb_set1(p[1]), pz = kb_set1(p[2]), three = kb_set1(3.);
+    for(;i+KB_WIDTH<=n;i+=KB_WIDTH){
+        kb_vec dx = kb_sub(px,kb_load(xs+i));
+        kb_vec dy = kb_sub(py,kb_load(ys+i));
+        kb_vec dz = kb_sub(pz,kb_load(zs+i));
+        kb_vec r2 = kb_add(kb_add(kb_mul(dx,dx),kb_mul(dy,dy)),kb_mul(dz,dz));
+        kb_vec r = kb_sqrt(r2);
+        kb_vec r3 = kb_mul(three,r);
+        kb_store(F+i,kb_mul(r2,r));
+        kb_store(G[0]+i,kb_mul(r3,dx));
+        kb_store(G[1]+i,kb_mul(r3,dy));
+        kb_store(G[2]+i,kb_mul(r3,dz));
+    }
+#endif
+    for(;i<n;++i){
+        double dx = p[0]-xs[i], dy = p[1]-ys[i], dz = p[2]-zs[i];
+        double r2 = dx*dx+dy*dy+dz*dz, r = sqrt(r2);
+        F[i] = r2*r;
+        G[0][i] = 3*r*dx;
+        G[1][i] = 3*r*dy;
+        G[2][i] = 3*r*dz;
+    }
+}
+
+
+void XCube_FGH_Kernel_Batch(const double *p, const double *xs, const double *ys, const double *zs, int n,
+                            double *F, double *const G[3], double *const H[6]){
+
+    int i = 0;
+#ifdef KB_WIDTH
+    const kb_vec px = kb_set1(p[0]), py = kb_set1(p[1]), pz = kb_set1(p[2]);
+    const kb_vec three = kb_set1(3.), eps = kb_set1(kb_eps);
+    for(;i+KB_WIDTH<=n;i+=KB_WIDTH){
+        kb_vec dx = kb_sub(px,kb_load(xs+i));
+        kb_vec dy = kb_sub(py,kb_load(ys+i));
+        kb_vec dz = kb_sub(pz,kb_load(zs+i));
+        kb_vec r2 = kb_add(kb_add(kb_mul(dx,dx),kb_mul(dy,dy)),kb_mul(dz,dz));
+        kb_vec r = kb_sqrt(r2);
+        kb_vec r3 = kb_mul(three,r);
+        kb_store(F+i,kb_mul(r2,r));
+        kb_store(G[0]+i,kb_mul(r3,dx));
+        kb_store(G[1]+i,kb_mul(r3,dy));
+        kb_store(G[2]+i,kb_mul(r3,dz));
+
+        // 3 d d^T / r + 3 r I, zero at coincident points
+        kb_vec ir = kb_mask_gt(r,eps,kb_div(three,r));
+        r3 = kb_mask_gt(r,eps,r3);
+        kb_vec irx = kb_mul(ir,dx), iry = kb_mul(ir,dy);
+        kb_store(H[0]+i,kb_add(kb_mul(irx,dx),r3));
+        kb_store(H[1]+i,kb_mul(irx,dy));
+        kb_store(H[2]+i,kb_mul(irx,dz));
+        kb_store(H[3]+i,kb_add(kb_mul(iry,dy),r3));
+        kb_store(H[4]+i,kb_mul(iry,dz));
+        kb_store(H[5]+i,kb_add(kb_mul(kb_mul(ir,dz),dz),r3));
+    }
+#endif
+    for(;i<n;++i){
+        double dx = p[0]-xs[i], dy = p[1]-ys[i], dz = p[2]-zs[i];
+        double r2 = dx*dx+dy*dy+dz*dz, r = sqrt(r2);
+        F[i] = r2*r;
+        G[0][i] = 3*r*dx;
+        G[1][i] = 3*r*dy;
+        G[2][i] = 3*r*dz;
+        if(r>kb_eps){
+            double ir = 3/r, r3 = 3*r;
+            H[0][i] = ir*dx*dx + r3;
+            H[1][i] = ir*dx*dy;
+            H[2][i] = ir*dx*dz;
+            H[3][i] = ir*dy*dy + r3;
+            H[4][i] = ir*dy*dz;
+            H[5][i] = ir*dz*dz + r3;
+        }else{
+            for(int k=0;k<6;++k)H[k][i] = 0;
+        }
+    }
+}
+
+
+double XCube_Hermite_Value(const double *p, const double *const S[7], int n){
+
+    const double *xs = S[0], *ys = S[1], *zs = S[2];
+    const double *pa = S[3], *gx = S[4], *gy = S[5], *gz = S[6];
+
+    // a r^3 + 3r (p-x).g = r (a r^2 + 3 (p-x).g)
+    double re = 0;
+    int i = 0;
+#ifdef KB_WIDTH
+    const kb_vec px = kb_set1(p[0]), py = kb_set1(p[1]), pz = kb_set1(p[2]), three = kb_set1(3.);
+    kb_vec acc = kb_set1(0.);
+    for(;i+KB_WIDTH<=n;i+=KB_WIDTH){
+        kb_vec dx = kb_sub(px,kb_load(xs+i));
+        kb_vec dy = kb_sub(py,kb_load(ys+i));
+        kb_vec dz = kb_sub(pz,kb_load(zs+i));
+        kb_vec r2 = kb_add(kb_add(kb_mul(dx,dx),kb_mul(dy,dy)),kb_mul(dz,dz));
+        kb_vec dg = kb_add(kb_add(kb_mul(dx,kb_load(gx+i)),kb_mul(dy,kb_load(gy+i))),kb_mul(dz,kb_load(gz+i)));
+        kb_vec t = kb_add(kb_mul(kb_load(pa+i),r2),kb_mul(three,dg));
+        acc = kb_add(acc,kb_mul(kb_sqrt(r2),t));
+    }
+    re = kb_hsum(acc);
+#endif
+    for(;i<n;++i){
+        double dx = p[0]-xs[i], dy = p[1]-ys[i], dz = p[2]-zs[i];
+        double r2 = dx*dx+dy*dy+dz*dz;
+        double dg = dx*gx[i]+dy*gy[i]+dz*gz[i];
+        re += sqrt(r2)*(pa[i]*r2 + 3*dg);
+    }
+    return re;
+}
+
+
+double XCube_Hermite_ValueGradient(const double *p, const double *const S[7], int n, double *grad){
+
+    const double *xs = S[0], *ys = S[1], *zs = S[2];
+    const double *pa = S[3], *gx = S[4], *gy = S[5], *gz = S[6];
+
+    // grad = a 3r d + H g, with H g = 3r g + (3/r) (d.g) d
+    double re = 0;
+    grad[0] = grad[1] = grad[2] = 0;
+    int i = 0;
+#ifdef KB_WIDTH
+    const kb_vec px = kb_set1(p[0]), py = kb_set1(p[1]), pz = kb_set1(p[2]);
+    const kb_vec three = kb_set1(3.), eps = kb_set1(kb_eps);
+    kb_vec acc = kb_set1(0.), accx = acc, accy = acc, accz = acc;
+    for(;i+KB_WIDTH<=n;i+=KB_WIDTH){
+        kb_vec dx = kb_sub(px,kb_load(xs+i));
+        kb_vec dy = kb_sub(py,kb_load(ys+i));
+        kb_vec dz = kb_sub(pz,kb_load(zs+i));
+        kb_vec vgx = kb_load(gx+i), vgy = kb_load(gy+i), vgz = kb_load(gz+i), va = kb_load(pa+i);
+        kb_vec r2 = kb_add(kb_add(kb_mul(dx,dx),kb_mul(dy,dy)),kb_mul(dz,dz));
+        kb_vec r = kb_sqrt(r2);
+        kb_vec r3 = kb_mul(three,r);
+        kb_vec dg = kb_add(kb_add(kb_mul(dx,vgx),kb_mul(dy,vgy)),kb_mul(dz,vgz));
+        acc = kb_add(acc,kb_mul(r,kb_add(kb_mul(va,r2),kb_mul(three,dg))));
+        kb_vec s = kb_mask_gt(r,eps,kb_div(kb_mul(three,dg),r));
+        accx = kb_add(accx,kb_add(kb_mul(r3,kb_add(kb_mul(va,dx),vgx)),kb_mul(s,dx)));
+        accy = kb_add(accy,kb_add(kb_mul(r3,kb_add(kb_mul(va,dy),vgy)),kb_mul(s,dy)));
+        accz = kb_add(accz,kb_add(kb_mul(r3,kb_add(kb_mul(va,dz),vgz)),kb_mul(s,dz)));
+    }
+    re = kb_hsum(acc);
+    grad[0] = kb_hsum(accx);
+    grad[1] = kb_hsum(accy);
+    grad[2] = kb_hsum(accz);
+#endif
+    for(;i<n;++i){
+        double dx = p[0]-xs[i], dy = p[1]-ys[i], dz = p[2]-zs[i];
+        double r2 = dx*dx+dy*dy+dz*dz, r = sqrt(r2), r3 = 3*r;
+        double dg = dx*gx[i]+dy*gy[i]+dz*gz[i];
+        re += r*(pa[i]*r2 + 3*dg);
+        double s = r>kb_eps ? 3*dg/r : 0;
+        grad[0] += r3*(pa[i]*dx + gx[i]) + s*dx;
+        grad[1] += r3*(pa[i]*dy + gy[i]) + s*dy;
+        grad[2] += r3*(pa[i]*dz + gz[i]) + s*dz;
+    }
+    return re;
+}
+
+
+double XCube_Hermite_Value_F32(const float *p, const float *const S[8], int n, double delta, double *err){
+
+    const float *xs = S[0], *ys = S[1], *zs = S[2];
+    const float *pa = S[3], *gx = S[4], *gy = S[5], *gz = S[6], *gn = S[7];
+
+    // float partial sums over blocks of 256 centers, added up in double.
+    // Alongside the value: sum r^2(|a|r + 3|g|), which bounds the rounding of
+    // each term, and sum r(|a|r + 2|g|), which bounds |d term/d x| and so the
+    // effect of rounding the coordinates to float (delta).
+    const int block = 256;
+#ifdef KBF_WIDTH
+    const int lanes = KBF_WIDTH;
+#else
+    const int lanes = 1;
+#endif
+    double re = 0, mag = 0, sens = 0;
+    for(int ib=0;ib<n;ib+=block){
+        int ie = min(ib+block, n), i = ib;
+        float fre = 0, fmag = 0, fsens = 0;
+#ifdef KBF_WIDTH
+        const kbf_vec px = kbf_set1(p[0]), py = kbf_set1(p[1]), pz = kbf_set1(p[2]);
+        const kbf_vec two = kbf_set1(2.f), three = kbf_set1(3.f);
+        kbf_vec acc = kbf_set1(0.f), accm = acc, accs = acc;
+        for(;i+KBF_WIDTH<=ie;i+=KBF_WIDTH){
+            kbf_vec dx = kbf_sub(px,kbf_load(xs+i));
+            kbf_vec dy = kbf_sub(py,kbf_load(ys+i));
+            kbf_vec dz = kbf_sub(pz,kbf_load(zs+i));
+            kbf_vec va = kbf_load(pa+i), vgn = kbf_load(gn+i);
+            kbf_vec r2 = kbf_add(kbf_add(kbf_mul(dx,dx),kbf_mul(dy,dy)),kbf_mul(dz,dz));
+            kbf_vec r = kbf_sqrt(r2);
+            kbf_vec dg = kbf_add(kbf_add(kbf_mul(dx,kbf_load(gx+i)),kbf_mul(dy,kbf_load(gy+i))),kbf_mul(dz,kbf_load(gz+i)));
+            acc = kbf_add(acc,kbf_mul(r,kbf_add(kbf_mul(va,r2),kbf_mul(three,dg))));
+            kbf_vec ra = kbf_mul(kbf_abs(va),r);
+            accm = kbf_add(accm,kbf_mul(r2,kbf_add(ra,kbf_mul(three,vgn))));
+            accs = kbf_add(accs,kbf_mul(r,kbf_add(ra,kbf_mul(two,vgn))));
+        }
+        re += kbf_hsum(acc);
+        mag += kbf_hsum(accm);
+        sens += kbf_hsum(accs);
+#endif
+        for(;i<ie;++i){
+            float dx = p[0]-xs[i], dy = p[1]-ys[i], dz = p[2]-zs[i];
+            float r2 = dx*dx+dy*dy+dz*dz, r = sqrtf(r2);
+            float dg = dx*gx[i]+dy*gy[i]+dz*gz[i];
+            float ra = fabsf(pa[i])*r;
+            fre += r*(pa[i]*r2 + 3*dg);
+            fmag += r2*(ra + 3*gn[i]);
+            fsens += r*(ra + 2*gn[i]);
+        }
+        re += fre;
+        mag += fmag;
+        sens += fsens;
+    }
+
+    // 24u per term for the arithmetic and the rounded coefficients, block/lanes u
+    // for the float accumulation, x2 for the bound sums themselves being rounded
+    const double u = 0.5*1.1920929e-7;
+    *err = 2*((26. + double(block)/lanes)*u*mag + 3*delta*sens);
+    return re;
+}
@@ -0,0 +1,37 @@
+#ifndef KERNELBATCH_H
+#define KERNELBATCH_H
+
+
+/* Batched triharmonic kernel phi = r^3 between one point p and n centers
+ * stored as structure of arrays (xs, ys, zs). Gradient and Hessian are taken
+ * with respect to p, i.e. they match XCube_Gradient_Kernel_2p(p, x_i) and
+ * XCube_Hessian_Kernel_2p(p, x_i). Outputs are also SoA: G[0..2] are the
+ * x/y/z gradient arrays, H[0..5] the xx, xy, xz, yy, yz, zz Hessian arrays.
+ * Compiled with AVX-512 or AVX2 the loops run 8 or 4 centers per instruction,
+ * otherwise they fall back to scalar code. */
+
+void XCube_FG_Kernel_Batch(const double *p, const double *xs, const double *ys, const double *zs, int n,
+                           double *F, double *const G[3]);
+
+void XCube_FGH_Kernel_Batch(const double *p, const double *xs, const double *ys, const double *zs, int n,
+                            double *F, double *const G[3], double *const H[6]);
+
+
+/* Fused Hermite field sums over n centers, in one pass and without
+ * temporaries:  sum_i a_i r_i^3 + 3 r_i (p-x_i).g_i  and its gradient.
+ * S[0..6] are the x, y, z, a, gx, gy, gz streams (see HermiteField). */
+
+double XCube_Hermite_Value(const double *p, const double *const S[7], int n);
+
+double XCube_Hermite_ValueGradient(const double *p, const double *const S[7], int n, double *grad);
+
+
+/* Single precision version of XCube_Hermite_Value for sign tests. S[7] holds
+ * |g_i|, and the coordinates should be centered so that they are small.
+ * delta bounds the error of the float coordinates (query and centers);
+ * err receives a forward bound on |returned value - exact sum|. */
+
+double XCube_Hermite_Value_F32(const float *p, const float *const S[8], int n, double delta, double *err);
+
+
+#endif // KERNELBATCH_H
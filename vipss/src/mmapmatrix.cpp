@@ -0,0 +1,202 @@
+#include "mmapmatrix.h"
+#include <iostream>
+#include <vector>
+#include <chrono>
+#include <cstring>
+#include <cstdlib>
+#include <cerrno>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+
+typedef std::chrono::high_resolution_clock Clock;
+
+extern "C" {
+void dsytrf_(const char *uplo, const int *n, double *a, const int *lda, int *ipiv,
+             double *work, const int *lwork, int *info);
+void dsytri2_(const char *uplo, const int *n, double *a, const int *lda, const int *ipiv,
+              double *work, const int *lwork, int *info);
+void dsyevr_(const char *jobz, const char *range, const char *uplo, const int *n, double *a,
+             const int *lda, const double *vl, const double *vu, const int *il, const int *iu,
+             const double *abstol, int *m, double *w, double *z, const int *ldz, int *isuppz,
+             double *work, const int *lwork, int *iwork, const int *liwork, int *info);
+void dgemm_(const char *transa, const char *transb, const int *m, const int *n, const int *k,
+            const double *alpha, const double *a, const int *lda, const double *b, const int *ldb,
+            const double *beta, double *c, const int *ldc);
+void dgemv_(const char *trans, const int *m, const int *n, const double *alpha,
+            const double *a, const int *lda, const double *x, const int *incx,
+            const double *beta, double *y, const int *incy);
+}
+
+
+MMap_Matrix::MMap_Matrix():n_rows(0),n_cols(0),p_data(NULL),n_bytes(0),fd(-1){}
+
+MMap_Matrix::~MMap_Matrix(){
+    Release();
+}
+
+bool MMap_Matrix::Allocate(size_t n_rows, size_t n_cols, string dir){
+
+    Release();
+
+    if(dir.empty())dir = "./";
+    if(dir.back()!='/')dir += "/";
+    string fname = dir + "vipss_mmap_XXXXXX";
+    vector<char>tmpl(fname.begin(),fname.end());
+    tmpl.push_back('\0');
+
+    fd = mkstemp(tmpl.data());
+    if(fd<0){
+        cout<<"MMap_Matrix: can not create scratch file in "<<dir<<endl;
+        return false;
+    }
+    // the mapping keeps the file alive; unlink so it is removed even if we crash
+    unlink(tmpl.data());
+
+    // reserve the blocks now: a sparse file that runs out of disk later
+    // faults with SIGBUS somewhere inside the factorization
+    n_bytes = n_rows * n_cols * sizeof(double);
+    int err = posix_fallocate(fd, 0, n_bytes);
+    if(err==EOPNOTSUPP)err = ftruncate(fd, n_bytes)!=0 ? errno : 0;
+    if(err!=0){
+        cout<<"MMap_Matrix: can not reserve "<<n_bytes<<" bytes in "<<dir<<": "<<strerror(err)<<endl;
+        close(fd);fd = -1;
+        n_bytes = 0;
+        return false;
+    }
+
+    void *ptr = mmap(NULL, n_bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if(ptr==MAP_FAILED){
+        cout<<"MMap_Matrix: mmap failed"<<endl;
+        close(fd);fd = -1;
+        return false;
+    }
+
+    p_data = (double*)ptr;
+    this->n_rows = n_rows;
+    this->n_cols = n_cols;
+
+    cout<<"MMap_Matrix: "<<n_rows<<" x "<<n_cols<<" ("<<n_bytes/1e9<<" GB) mapped in "<<dir<<endl;
+    return true;
+}
+
+void MMap_Matrix::Release(){
+
+    if(p_data!=NULL)munmap(p_data, n_bytes);
+    if(fd>=0)close(fd);
+    p_data = NULL;
+    fd = -1;
+    n_bytes = n_rows = n_cols = 0;
+}
+
+arma::mat MMap_Matrix::SubMat(size_t r0, size_t c0, size_t r1, size_t c1) const{
+
+    size_t nr = r1 - r0 + 1, nc = c1 - c0 + 1;
+    arma::mat re(nr, nc);
+    for(size_t j=0;j<nc;++j)
+        memcpy(re.colptr(j), p_data + (c0+j)*n_rows + r0, nr*sizeof(double));
+    return re;
+}
+
+void MMap_Matrix::SubMatVec(size_t r0, size_t c0, size_t nr, size_t nc, const double *x, double *y,
+                            bool istrans, double alpha, double beta) const{
+
+    const char trans = istrans ? 'T' : 'N';
+    const int m = nr, n = nc, lda = n_rows, inc = 1;
+    dgemv_(&trans, &m, &n, &alpha, p_data + c0*n_rows + r0, &lda, x, &inc, &beta, y, &inc);
+}
+
+void MMap_Matrix::SubMatMul(size_t r0, size_t c0, size_t nr, size_t nc, const double *B, size_t ncb,
+                            double *C, size_t ldc, bool istrans, double alpha, double beta) const{
+
+    const char transa = istrans ? 'T' : 'N', transb = 'N';
+    const int m = istrans ? nc : nr, k = istrans ? nr : nc, n = ncb;
+    const int lda = n_rows, ldb = k, ldC = ldc;
+    dgemm_(&transa, &transb, &m, &n, &k, &alpha, p_data + c0*n_rows + r0, &lda, B, &ldb, &beta, C, &ldC);
+}
+
+int MMap_Matrix::LDLT_Inverse(){
+
+    const char uplo = 'L';
+    const int n = n_rows, lda = n_rows;
+    int info = 0, lwork = -1;
+    double wsize;
+    vector<int>ipiv(n);
+
+    auto t1 = Clock::now();
+
+    // workspace query, then the blocked Bunch-Kaufman LDL^T factorization
+    dsytrf_(&uplo, &n, p_data, &lda, ipiv.data(), &wsize, &lwork, &info);
+    lwork = int(wsize);
+    vector<double>work(lwork);
+    dsytrf_(&uplo, &n, p_data, &lda, ipiv.data(), work.data(), &lwork, &info);
+    if(info!=0){
+        cout<<"MMap_Matrix: dsytrf failed, info = "<<info<<endl;
+        return 0;
+    }
+    cout<<"LDLT factor: "<<std::chrono::nanoseconds(Clock::now() - t1).count()/1e9<<endl;
+
+    t1 = Clock::now();
+    lwork = -1;
+    dsytri2_(&uplo, &n, p_data, &lda, ipiv.data(), &wsize, &lwork, &info);
+    lwork = int(wsize);
+    work.resize(lwork);
+    dsytri2_(&uplo, &n, p_data, &lda, ipiv.data(), work.data(), &lwork, &info);
+    if(info!=0){
+        cout<<"MMap_Matrix: dsytri2 failed, info = "<<info<<endl;
+        return 0;
+    }
+    cout<<"LDLT inverse: "<<std::chrono::nanoseconds(Clock::now() - t1).count()/1e9<<endl;
+
+    Symmetrize_FromLower();
+    return 1;
+}
+
+void MMap_Matrix::Symmetrize_FromLower(){
+
+    // copy the lower triangle to the upper one tile by tile, so both the
+    // read and the write side stay within a few pages of the mapping
+    const size_t tile = 256;
+    for(size_t jb=0;jb<n_cols;jb+=tile){
+        size_t je = min(jb+tile, n_cols);
+        for(size_t ib=jb;ib<n_rows;ib+=tile){
+            size_t ie = min(ib+tile, n_rows);
+            for(size_t j=jb;j<je;++j)
+                for(size_t i=max(ib,j+1);i<ie;++i)
+                    p_data[i*n_rows+j] = p_data[j*n_rows+i];
+        }
+    }
+}
+
+int MMap_Matrix::Eig_Smallest(double &eigval, arma::vec &eigvec){
+
+    const char jobz = 'V', range = 'I', uplo = 'L';
+    const int n = n_rows, lda = n_rows, il = 1, iu = 1;
+    const double vl = 0, vu = 0, abstol = 0;
+    int m = 0, info = 0, lwork = -1, liwork = -1, iwsize;
+    double wsize;
+    vector<double>w(n);
+    vector<int>isuppz(2);
+    eigvec.set_size(n);
+
+    auto t1 = Clock::now();
+
+    // only the first eigenpair: the tridiagonal reduction runs on the mapping,
+    // the rest needs O(n) memory
+    dsyevr_(&jobz, &range, &uplo, &n, p_data, &lda, &vl, &vu, &il, &iu, &abstol, &m, w.data(),
+            eigvec.memptr(), &n, isuppz.data(), &wsize, &lwork, &iwsize, &liwork, &info);
+    lwork = int(wsize);
+    liwork = iwsize;
+    vector<double>work(lwork);
+    vector<int>iwork(liwork);
+    dsyevr_(&jobz, &range, &uplo, &n, p_data, &lda, &vl, &vu, &il, &iu, &abstol, &m, w.data(),
+            eigvec.memptr(), &n, isuppz.data(), work.data(), &lwork, iwork.data(), &liwork, &info);
+    if(info!=0 || m!=1){
+        cout<<"MMap_Matrix: dsyevr failed, info = "<<info<<endl;
+        return 0;
+    }
+    cout<<"smallest eigenpair: "<<std::chrono::nanoseconds(Clock::now() - t1).count()/1e9<<endl;
+
+    eigval = w[0];
+    return 1;
+}
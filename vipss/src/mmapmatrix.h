@@ -0,0 +1,72 @@
+#ifndef MMAPMATRIX_H
+#define MMAPMATRIX_H
+
+
+#include <string>
+#include <armadillo>
+using namespace std;
+
+
+/* Column-major dense matrix stored in a memory-mapped scratch file.
+ * Used for the (4N+4)x(4N+4) Hermite system when it does not fit in RAM:
+ * the OS pages tiles in and out, so large inputs run at disk speed instead
+ * of failing the allocation. */
+class MMap_Matrix{
+
+public:
+
+    size_t n_rows;
+    size_t n_cols;
+
+private:
+
+    double *p_data;
+    size_t n_bytes;
+    int fd;
+
+public:
+
+    MMap_Matrix();
+    ~MMap_Matrix();
+
+    MMap_Matrix(const MMap_Matrix &) = delete;
+    MMap_Matrix &operator=(const MMap_Matrix &) = delete;
+
+    bool Allocate(size_t n_rows, size_t n_cols, string dir);
+    void Release();
+    bool IsAllocated() const { return p_data != NULL; }
+
+    double *memptr() { return p_data; }
+    const double *memptr() const { return p_data; }
+
+    inline double &operator()(size_t i, size_t j) { return p_data[j*n_rows+i]; }
+    inline double operator()(size_t i, size_t j) const { return p_data[j*n_rows+i]; }
+
+public:
+
+    // in-core copy of rows r0..r1, cols c0..c1 (inclusive, as arma::submat)
+    arma::mat SubMat(size_t r0, size_t c0, size_t r1, size_t c1) const;
+
+    // y = alpha * A(r0:r0+nr, c0:c0+nc) * x + beta * y, or with A^T if istrans
+    void SubMatVec(size_t r0, size_t c0, size_t nr, size_t nc, const double *x, double *y,
+                   bool istrans = false, double alpha = 1., double beta = 0.) const;
+
+    // C = alpha * A(r0:r0+nr, c0:c0+nc) * B + beta * C, or with A^T if istrans;
+    // B (in core) has ncb columns, C has leading dimension ldc
+    void SubMatMul(size_t r0, size_t c0, size_t nr, size_t nc, const double *B, size_t ncb,
+                   double *C, size_t ldc, bool istrans = false, double alpha = 1., double beta = 0.) const;
+
+    // in-place inverse of a symmetric (indefinite) matrix through a blocked LDL^T factorization
+    int LDLT_Inverse();
+
+    // smallest eigenvalue and its eigenvector of a symmetric matrix; overwrites the matrix
+    int Eig_Smallest(double &eigval, arma::vec &eigvec);
+
+private:
+
+    void Symmetrize_FromLower();
+
+};
+
+
+#endif // MMAPMATRIX_H
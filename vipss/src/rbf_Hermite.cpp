@@ -1,12 +1,14 @@
 #include "rbfcore.h"
 #include "utility.h"
 #include "Solver.h"
+#include "kernelbatch.h"
 #include <armadillo>
 #include <fstream>
 #include <limits>
 #include <unordered_map>
 #include <ctime>
 #include <chrono>
+#include <cstring>
 #include <iomanip>
 #include <algorithm>
 #include <queue>
@@ -91,49 +93,89 @@ void RBF_Core::Set_HermiteRBF(vector<double>&pts){
     isHermite = true;
 
     a.set_size(npt*4);
-    M.set_size(npt*4,npt*4);
-    double *p_pts = pts.data();
-    for(int i=0;i<npt;++i){
-        for(int j=i;j<npt;++j){
-            M(i,j) = M(j,i) = Kernal_Function_2p(p_pts+i*3, p_pts+j*3);
+
+    // out-of-core: assemble straight into the top-left block of the mapped bigM
+    double *p_M;
+    size_t ld;
+    if(isoutofcore){
+        if(!ooc_bigM.Allocate((npt+1)*4,(npt+1)*4,outofcore_dir)){
+            cout<<"fall back to in-core matrices"<<endl;
+            isoutofcore = false;
         }
     }
+    if(isoutofcore){
+        p_M = ooc_bigM.memptr();
+        ld = ooc_bigM.n_rows;
+    }else{
+        M.set_size(npt*4,npt*4);
+        p_M = M.memptr();
+        ld = npt*4;
+    }
+    auto M_ = [p_M,ld](size_t i, size_t j)->double&{ return p_M[j*ld+i]; };
 
+    //tiled assembly: every unordered pair (i,j) is evaluated once, and the
+    //mirrored (j,i) entries of a tile pair are written while still in cache.
+    //For each column point j, the tile rows i are evaluated as one batch.
+    const int tile = 64;
+    int ntile = (npt+tile-1)/tile;
+    vector<pair<int,int> >tilepairs;
+    for(int jt=0;jt<ntile;++jt)for(int it=0;it<=jt;++it)tilepairs.push_back(make_pair(it,jt));
 
-    //if(User_Lamnbda!=0)for(int i=0;i<npt;++i)M(i,i) += User_Lamnbda;
-
+    const bool isbatch = kernal==XCube;
+    const int hind[9] = {0,1,2, 1,3,4, 2,4,5}, hsrc[6] = {0,1,2,4,5,8};
 
-    double G[3];
-    for(int i=0;i<npt;++i){
-        for(int j=0;j<npt;++j){
+    auto t1 = Clock::now();
+    const double *p_pts = pts.data();
+    const double *xs = pts_soa.data(), *ys = xs+npt, *zs = xs+npt*2;
+    #pragma omp parallel for schedule(dynamic)
+    for(int t=0;t<int(tilepairs.size());++t){
+        int ib = tilepairs[t].first*tile, jb = tilepairs[t].second*tile;
+        int ie = min(ib+tile,npt), je = min(jb+tile,npt);
+
+        double F[tile], Gb[3][tile], Hb[6][tile];
+        double *G[3] = {Gb[0],Gb[1],Gb[2]};
+        double *H[6] = {Hb[0],Hb[1],Hb[2],Hb[3],Hb[4],Hb[5]};
+        for(int j=jb;j<je;++j){
+            const double *p_j = p_pts+j*3;
+            int m = min(ie,j+1) - ib;
+            if(m<=0)continue;
+
+            //kernel of p_j against p_i, i in [ib, ib+m)
+            if(isbatch)XCube_FGH_Kernel_Batch(p_j, xs+ib, ys+ib, zs+ib, m, F, G, H);
+            else{
+                double g[3], h[9];
+                for(int c=0;c<m;++c){
+                    const double *p_i = p_pts+(ib+c)*3;
+                    if(Kernal_FGH_Function_2p!=NULL)Kernal_FGH_Function_2p(p_j, p_i, F+c, g, h);
+                    else{
+                        F[c] = Kernal_Function_2p(p_j, p_i);
+                        Kernal_Gradient_Function_2p(p_j, p_i, g);
+                        Kernal_Hessian_Function_2p(p_j, p_i, h);
+                    }
+                    for(int k=0;k<3;++k)G[k][c] = g[k];
+                    for(int k=0;k<6;++k)H[k][c] = h[hsrc[k]];
+                }
+            }
 
-            Kernal_Gradient_Function_2p(p_pts+i*3, p_pts+j*3, G);
-            //            int jind = j*3+npt;
-            //            for(int k=0;k<3;++k)M(i,jind+k) = -G[k];
-            //            for(int k=0;k<3;++k)M(jind+k,i) = G[k];
+            for(int c=0;c<m;++c){
+                int i = ib+c;
+                M_(i,j) = M_(j,i) = F[c];
 
-            for(int k=0;k<3;++k)M(i,npt+j+k*npt) = G[k];
-            for(int k=0;k<3;++k)M(npt+j+k*npt,i) = G[k];
+                //G[.][c] = grad(p_j, p_i) = -grad(p_i, p_j) for radial kernels
+                for(int k=0;k<3;++k){
+                    M_(i,npt+j+k*npt) = M_(npt+j+k*npt,i) = -G[k][c];
+                    M_(j,npt+i+k*npt) = M_(npt+i+k*npt,j) = G[k][c];
+                }
 
+                for(int k=0;k<3;++k)
+                    for(int l=0;l<3;++l)
+                        M_(npt+j+l*npt,npt+i+k*npt) = M_(npt+i+k*npt,npt+j+l*npt) = -H[hind[k*3+l]][c];
+            }
         }
     }
+    cout<<"assemble M: "<<std::chrono::nanoseconds(Clock::now() - t1).count()/1e9<<endl;
 
-    double H[9];
-    for(int i=0;i<npt;++i){
-        for(int j=i;j<npt;++j){
-
-            Kernal_Hessian_Function_2p(p_pts+i*3, p_pts+j*3, H);
-            //            int iind = i*3+npt;
-            //            int jind = j*3+npt;
-            //            for(int k=0;k<3;++k)
-            //                for(int l=0;l<3;++l)
-            //                    M(jind+l,iind+k) = M(iind+k,jind+l) = -H[k*3+l];
-
-            for(int k=0;k<3;++k)
-                for(int l=0;l<3;++l)
-                    M(npt+j+l*npt,npt+i+k*npt) = M(npt+i+k*npt,npt+j+l*npt) = -H[k*3+l];
-        }
-    }
+    //if(User_Lamnbda!=0)for(int i=0;i<npt;++i)M(i,i) += User_Lamnbda;
 
     //cout<<std::setprecision(5)<<std::fixed<<M<<endl;
 
@@ -184,6 +226,375 @@ void RBF_Core::Set_HermiteRBF(vector<double>&pts){
 }
 
 
+void RBF_Core::Set_HermiteBlock(const double *p_r, int nr, const double *p_c, int nc, arma::mat &Mb){
+
+    //the [a, gx, gy, gz] x [a, gx, gy, gz] block of M between two point sets
+    Mb.set_size(nr*4,nc*4);
+    double G[3], H[9];
+    for(int j=0;j<nc;++j){
+        for(int i=0;i<nr;++i){
+            const double *p_i = p_r+i*3, *p_j = p_c+j*3;
+            Mb(i,j) = Kernal_Function_2p(p_i, p_j);
+
+            Kernal_Gradient_Function_2p(p_i, p_j, G);
+            for(int k=0;k<3;++k)Mb(i,nc+j+k*nc) = G[k];
+            Kernal_Gradient_Function_2p(p_j, p_i, G);
+            for(int k=0;k<3;++k)Mb(nr+i+k*nr,j) = G[k];
+
+            Kernal_Hessian_Function_2p(p_i, p_j, H);
+            for(int k=0;k<3;++k)
+                for(int l=0;l<3;++l)
+                    Mb(nr+i+k*nr,nc+j+l*nc) = -H[k*3+l];
+        }
+    }
+}
+
+
+//implicit kd-tree over the point ids ind[lo, hi): the median along axis
+//depth%3 splits the range, its halves are the subtrees
+static void BuildKdTree(const double *p, vector<int>&ind, int lo, int hi, int depth){
+
+    if(hi-lo<=1)return;
+    int mid = (lo+hi)/2, d = depth%3;
+    nth_element(ind.begin()+lo, ind.begin()+mid, ind.begin()+hi,
+                [p,d](int i, int j){ return p[i*3+d]<p[j*3+d]; });
+    BuildKdTree(p,ind,lo,mid,depth+1);
+    BuildKdTree(p,ind,mid+1,hi,depth+1);
+}
+
+static void NearestKdTree(const double *p, const vector<int>&ind, int lo, int hi, int depth,
+                          const double *q, int &best, double &bestdist){
+
+    if(hi<=lo)return;
+    int mid = (lo+hi)/2, d = depth%3, i = ind[mid];
+    double dist = MyUtility::vecSquareDist(p+i*3,q);
+    if(dist<bestdist){bestdist = dist;best = i;}
+    double off = q[d]-p[i*3+d];
+    //the side of q first, the other one only if the splitting plane is closer than the best
+    if(off<0)NearestKdTree(p,ind,lo,mid,depth+1,q,best,bestdist);
+    else NearestKdTree(p,ind,mid+1,hi,depth+1,q,best,bestdist);
+    if(off*off<bestdist){
+        if(off<0)NearestKdTree(p,ind,mid+1,hi,depth+1,q,best,bestdist);
+        else NearestKdTree(p,ind,lo,mid,depth+1,q,best,bestdist);
+    }
+}
+
+//nearest of the n points p_ref to each of the k points p_q
+static void NearestPoints(const double *p_ref, int n, const double *p_q, int k, vector<int>&nearest){
+
+    vector<int>ind(n);
+    for(int i=0;i<n;++i)ind[i] = i;
+    BuildKdTree(p_ref,ind,0,n,0);
+
+    nearest.resize(k);
+    #pragma omp parallel for schedule(dynamic, 64)
+    for(int j=0;j<k;++j){
+        int best = 0;
+        double bestdist = DBL_MAX;
+        NearestKdTree(p_ref,ind,0,n,0,p_q+j*3,best,bestdist);
+        nearest[j] = best;
+    }
+}
+
+
+int RBF_Core::InsertPoints(vector<double>&newpts){
+
+    if(isoutofcore || !isnewformula || Minv.is_empty()){
+        cout<<"InsertPoints: needs a solved in-core system"<<endl;
+        return 0;
+    }
+    int k = newpts.size()/3;
+    if(k==0)return 1;
+
+    cout<<"InsertPoints: "<<k<<endl;
+    auto t1 = Clock::now();
+
+    int n = npt, nn = npt + k;
+    int no = n*4+4, nb = no+k*4;
+
+    //inverse of the current saddle system [M N; N^T 0]
+    arma::mat Ainv;
+    Get_bigMinv(Ainv);
+
+    //border: old unknowns and polynomial against the new unknowns
+    arma::mat B, Bk, C;
+    B.zeros(no,k*4);
+    Set_HermiteBlock(pts.data(),n,newpts.data(),k,Bk);
+    B.submat(0,0,n*4-1,k*4-1) = Bk;
+    for(int j=0;j<k;++j){
+        B(n*4,j) = 1;
+        for(int d=0;d<3;++d){
+            B(n*4+1+d,j) = newpts[j*3+d];
+            B(n*4+1+d,k+j+d*k) = -1;
+        }
+    }
+    Set_HermiteBlock(newpts.data(),k,newpts.data(),k,C);
+
+    //block inverse through the Schur complement S = C - B^T A^-1 B
+    arma::mat W = Ainv * B;
+    arma::mat Sinv = inv(C - B.t() * W);
+    arma::mat WS = W * Sinv;
+
+    arma::mat borderinv(nb,nb);
+    borderinv.submat(0,0,no-1,no-1) = Ainv + WS * W.t();
+    borderinv.submat(0,no,no-1,nb-1) = -WS;
+    borderinv.submat(no,0,nb-1,no-1) = -WS.t();
+    borderinv.submat(no,no,nb-1,nb-1) = Sinv;
+    Ainv.clear();W.clear();WS.clear();
+
+    //back to the [a, gx, gy, gz, poly] order of the enlarged point set
+    arma::uvec ind_M(nn*4), ind_P(4);
+    for(int d=0;d<4;++d){
+        for(int i=0;i<n;++i)ind_M(d*nn+i) = d*n+i;
+        for(int j=0;j<k;++j)ind_M(d*nn+n+j) = no+d*k+j;
+    }
+    for(int i=0;i<4;++i)ind_P(i) = n*4+i;
+
+    Minv = borderinv.submat(ind_M,ind_M);
+    Ninv = borderinv.submat(ind_M,ind_P);
+    Cinv = borderinv.submat(ind_P,ind_P);
+    borderinv.clear();
+
+    pts.insert(pts.end(),newpts.begin(),newpts.end());
+    npt = nn;
+    Set_PtsSoA();
+    //the coefficients are those of the old points: unsolved until OptNormal
+    a.reset();
+
+    Set_HermiteInverseBlocks(Minv);
+
+    //warm start: keep the optimized normals, new points copy their nearest old point
+    if(newnormals.size()==n*3){
+        initnormals = newnormals;
+        initnormals.resize(npt*3);
+        vector<int>nearest;
+        NearestPoints(pts.data(),n,pts.data()+n*3,k,nearest);
+        for(int j=0;j<k;++j)for(int d=0;d<3;++d)initnormals[(n+j)*3+d] = newnormals[nearest[j]*3+d];
+        SetInitnormal_Uninorm();
+    }
+
+    cout<<"InsertPoints time: "<<std::chrono::nanoseconds(Clock::now() - t1).count()/1e9<<endl;
+    return 1;
+}
+
+
+int RBF_Core::RemovePoints(vector<int>&rmind){
+
+    if(isoutofcore || !isnewformula || Minv.is_empty()){
+        cout<<"RemovePoints: needs a solved in-core system"<<endl;
+        return 0;
+    }
+
+    vector<bool>isremoved(npt,false);
+    for(auto ind:rmind)if(ind>=0 && ind<npt)isremoved[ind] = true;
+    int k = count(isremoved.begin(),isremoved.end(),true);
+    if(k==0)return 1;
+    if(npt-k<4){
+        cout<<"RemovePoints: too few points left"<<endl;
+        return 0;
+    }
+
+    cout<<"RemovePoints: "<<k<<endl;
+    auto t1 = Clock::now();
+
+    int n = npt, nn = npt - k;
+
+    //removed (R) and kept (S) unknowns; S keeps the [a, gx, gy, gz, poly] order
+    arma::uvec ind_R(k*4), ind_S(nn*4+4);
+    for(int d=0;d<4;++d){
+        int ir = 0, is = 0;
+        for(int i=0;i<n;++i){
+            if(isremoved[i])ind_R(d*k+ir++) = d*n+i;
+            else ind_S(d*nn+is++) = d*n+i;
+        }
+    }
+    for(int i=0;i<4;++i)ind_S(nn*4+i) = n*4+i;
+
+    //inverse of the principal submatrix on S: Z_SS - Z_SR Z_RR^-1 Z_RS
+    arma::mat Z;
+    Get_bigMinv(Z);
+    arma::mat Zsr = Z.submat(ind_S,ind_R);
+    arma::mat Zrr = Z.submat(ind_R,ind_R);
+    Z = Z.submat(ind_S,ind_S) - Zsr * solve(Zrr, Zsr.t());
+    Zsr.clear();
+
+    Minv = Z.submat(0,0,nn*4-1,nn*4-1);
+    Ninv = Z.submat(0,nn*4,nn*4-1,nn*4+3);
+    Cinv = Z.submat(nn*4,nn*4,nn*4+3,nn*4+3);
+    Z.clear();
+
+    vector<double>keptpts, keptnormals;
+    keptpts.reserve(nn*3);
+    for(int i=0;i<n;++i)if(!isremoved[i]){
+        for(int d=0;d<3;++d)keptpts.push_back(pts[i*3+d]);
+        if(newnormals.size()==n*3)for(int d=0;d<3;++d)keptnormals.push_back(newnormals[i*3+d]);
+    }
+    pts.swap(keptpts);
+    npt = nn;
+    Set_PtsSoA();
+    //the coefficients are those of the old points: unsolved until OptNormal
+    a.reset();
+
+    Set_HermiteInverseBlocks(Minv);
+
+    if(keptnormals.size()==nn*3){
+        initnormals = newnormals = keptnormals;
+        SetInitnormal_Uninorm();
+    }
+
+    cout<<"RemovePoints time: "<<std::chrono::nanoseconds(Clock::now() - t1).count()/1e9<<endl;
+    return 1;
+}
+
+
+int RBF_Core::LeaveOneOut_Residuals(vector<double>&res_value, vector<double>&res_gradient){
+
+    if(Minv.is_empty() || a.n_elem!=npt*4){
+        cout<<"LeaveOneOut_Residuals: needs a solved in-core system"<<endl;
+        return 0;
+    }
+
+    //for A c = y, y_R - f^{-R}(x_R) = (A^-1)_RR^-1 c_R, with R the 4 unknowns of one point;
+    //A is the whole bordered system, so (A^-1)_RR is a block of Minv and the polynomial
+    //of the refit is accounted for without Ninv/Cinv
+    res_value.resize(npt);
+    res_gradient.resize(npt*3);
+    arma::mat Zrr(4,4);
+    arma::vec cr(4), er;
+    for(int i=0;i<npt;++i){
+        for(int d=0;d<4;++d){
+            cr(d) = a(d*npt+i);
+            for(int e=0;e<4;++e)Zrr(d,e) = Minv(d*npt+i,e*npt+i);
+        }
+        er = solve(Zrr,cr);
+        res_value[i] = er(0);
+        for(int d=0;d<3;++d)res_gradient[i*3+d] = er(d+1);
+    }
+    return 1;
+}
+
+
+int RBF_Core::RemoveOutliers(int k){
+
+    vector<double>res_value, res_gradient;
+    if(!LeaveOneOut_Residuals(res_value,res_gradient))return 0;
+    k = min(k,npt);
+    if(k<=0)return 1;
+
+    //rank by the value residual, the distance-like misfit at the point itself
+    vector<int>order(npt);
+    for(int i=0;i<npt;++i)order[i] = i;
+    partial_sort(order.begin(),order.begin()+k,order.end(),[&](int i, int j){
+        return fabs(res_value[i])>fabs(res_value[j]);
+    });
+    order.resize(k);
+
+    cout<<"leave-one-out outliers (index, point, value residual, gradient residual):"<<endl;
+    for(auto i:order){
+        double *g = res_gradient.data()+i*3;
+        cout<<i<<"  "<<pts[i*3]<<' '<<pts[i*3+1]<<' '<<pts[i*3+2]<<"  "<<res_value[i]<<"  "
+           <<sqrt(g[0]*g[0]+g[1]*g[1]+g[2]*g[2])<<endl;
+    }
+    return RemovePoints(order);
+}
+
+
+double RBF_Core::Check_InverseBlocks(){
+
+    if(isoutofcore || !isnewformula || Minv.is_empty()){
+        cout<<"Check_InverseBlocks: needs a solved in-core system"<<endl;
+        return -1;
+    }
+
+    //the saddle system of the current points from scratch; Set_HermiteRBF
+    //resizes a and b, which the current fit still needs
+    arma::vec save_a = a, save_b = b;
+    Set_HermiteRBF(pts);
+    arma::mat refM;
+    refM.zeros((npt+1)*4,(npt+1)*4);
+    refM.submat(0,0,npt*4-1,npt*4-1) = M;
+    refM.submat(0,npt*4,npt*4-1,npt*4+3) = N;
+    refM.submat(npt*4,0,npt*4+3,npt*4-1) = N.t();
+    M.clear();N.clear();
+    a = save_a;b = save_b;
+
+    arma::mat Z;
+    Get_bigMinv(Z);
+    arma::mat refZ = inv(refM);
+    arma::mat diff = abs(Z - refZ), mag = abs(refZ);
+    double err = diff.max()/mag.max();
+    cout<<"Check_InverseBlocks: max difference to a fresh inverse "<<err<<" (relative to its max entry)"<<endl;
+    return err;
+}
+
+
+double RBF_Core::Check_LeaveOneOut(int ncheck){
+
+    vector<double>res_value, res_gradient;
+    if(isoutofcore || !LeaveOneOut_Residuals(res_value,res_gradient))return -1;
+
+    //the bordered system and the right-hand side the current a, b solve
+    arma::vec save_a = a, save_b = b;
+    Set_HermiteRBF(pts);
+    int no = npt*4+4;
+    arma::mat A;
+    A.zeros(no,no);
+    A.submat(0,0,npt*4-1,npt*4-1) = M;
+    A.submat(0,npt*4,npt*4-1,no-1) = N;
+    A.submat(npt*4,0,no-1,npt*4-1) = N.t();
+    M.clear();N.clear();
+    a = save_a;b = save_b;
+    arma::vec c(no);
+    for(int i=0;i<npt*4;++i)c(i) = a(i);
+    for(int i=0;i<4;++i)c(npt*4+i) = b(i);
+    arma::vec y = A * c;
+
+    //refit without the 4 unknowns of point i, residual at point i
+    double err = 0, scale = 0;
+    ncheck = min(ncheck,npt);
+    arma::uvec ind_R(4), ind_S(no-4);
+    for(int i=0;i<ncheck;++i){
+        int is = 0;
+        for(int j=0;j<no;++j){
+            if(j<npt*4 && j%npt==i)ind_R(j/npt) = j;
+            else ind_S(is++) = j;
+        }
+        arma::vec ys(no-4);
+        for(int j=0;j<no-4;++j)ys(j) = y(ind_S(j));
+        arma::vec cs = solve(A.submat(ind_S,ind_S),ys);
+        arma::vec fr = A.submat(ind_R,ind_S) * cs;
+        for(int d=0;d<4;++d){
+            double er = y(ind_R(d)) - fr(d);
+            double loo = d==0 ? res_value[i] : res_gradient[i*3+d-1];
+            err = max(err,fabs(er-loo));
+            scale = max(scale,fabs(er));
+        }
+    }
+    cout<<"Check_LeaveOneOut: "<<ncheck<<" refits, max difference "<<err<<" (residuals up to "<<scale<<")"<<endl;
+    return err;
+}
+
+
+void RBF_Core::Get_bigMinv(arma::mat &Z){
+
+    int no = npt*4+4;
+    Z.set_size(no,no);
+    Z.submat(0,0,npt*4-1,npt*4-1) = Minv;
+    Z.submat(0,npt*4,npt*4-1,no-1) = Ninv;
+    Z.submat(npt*4,0,no-1,npt*4-1) = Ninv.t();
+    Z.submat(npt*4,npt*4,no-1,no-1) = Cinv;
+}
+
+
+void RBF_Core::Set_HermiteInverseBlocks(arma::mat &Z){
+
+    K00 = Z.submat(0,0,npt-1,npt-1);
+    K01 = Z.submat(0,npt,npt-1,npt*4-1);
+    K11 = Z.submat( npt, npt, npt*4-1, npt*4-1 );
+    Set_User_Lamnda_ToMatrix(User_Lamnbda_inject);
+}
+
+
 double Gaussian_2p(const double *p1, const double *p2, double sigma){
 
     return exp(-MyUtility::vecSquareDist(p1,p2)/(2*sigma*sigma));
@@ -206,13 +617,28 @@ void RBF_Core::Set_SparsePara(double spa){
     sparse_para = spa;
 }
 
-void RBF_Core::Set_User_Lamnda_ToMatrix(double user_ls){
+int RBF_Core::Set_User_Lamnda_ToMatrix(double user_ls){
 
 
     {
         Set_Actual_User_LSCoef(user_ls);
         auto t1 = Clock::now();
         cout<<"setting K, HermiteApprox_Lamnda"<<endl;
+        if(isoutofcore){
+            // K11 stays in the mapping, finalH is formed in a second one
+            if(User_Lamnbda>0){
+                arma::sp_mat eye;
+                eye.eye(npt,npt);
+
+                dI = inv(eye + User_Lamnbda*K00);
+            }
+            if(!Set_OutOfCore_K(ooc_finalH, User_Lamnbda, dI)){
+                cout<<"out-of-core finalH failed"<<endl;
+                return 0;
+            }
+            cout<<"solved: "<<(std::chrono::nanoseconds(Clock::now() - t1).count()/1e9)<<endl;
+            return 1;
+        }
         if(User_Lamnbda>0){
             arma::sp_mat eye;
             eye.eye(npt,npt);
@@ -225,17 +651,60 @@ void RBF_Core::Set_User_Lamnda_ToMatrix(double user_ls){
     }
 
     finalH = saveK_finalH;
+    return 1;
 
 }
 
-void RBF_Core::Set_HermiteApprox_Lamnda(double hermite_ls){
+void RBF_Core::FinalH_MatVec(const arma::vec &x, arma::vec &y){
+
+    if(!isoutofcore){
+        y = finalH * x;
+        return;
+    }
+
+    y.set_size(npt*3);
+    ooc_finalH.SubMatVec(0,0,npt*3,npt*3,x.memptr(),y.memptr());
+}
+
+bool RBF_Core::Set_OutOfCore_K(MMap_Matrix &dst, double lamnbda, const arma::mat &lamnbda_dI){
+
+    // dst = K11 - lamnbda * K01^T * lamnbda_dI * K01, a tile of columns at a time,
+    // so only K00 and dI (npt x npt each) are ever in core
+    const size_t n = npt, ld = ooc_bigM.n_rows, tile = 256;
+    if(!dst.Allocate(n*3,n*3,outofcore_dir))return false;
+    arma::mat W;
+    for(size_t j0=0;j0<n*3;j0+=tile){
+        const size_t nc = min(tile, n*3-j0);
+        for(size_t j=0;j<nc;++j)
+            memcpy(dst.memptr()+(j0+j)*n*3, ooc_bigM.memptr()+(n+j0+j)*ld+n, n*3*sizeof(double));
+        if(lamnbda<=0)continue;
+        W = lamnbda_dI * ooc_bigM.SubMat(0,n+j0,n-1,n+j0+nc-1);
+        ooc_bigM.SubMatMul(0,n,n,n*3,W.memptr(),nc,dst.memptr()+j0*n*3,n*3,true,-lamnbda,1.);
+    }
+    return true;
+}
+
+int RBF_Core::Set_HermiteApprox_Lamnda(double hermite_ls){
 
 
     {
         Set_Actual_Hermite_LSCoef(hermite_ls);
         auto t1 = Clock::now();
         cout<<"setting K, HermiteApprox_Lamnda"<<endl;
-        if(ls_coef>0){
+        if(isoutofcore){
+            // a mapped copy, as the eigen initialization overwrites it
+            double lamnbda = ls_coef>0 ? ls_coef+User_Lamnbda : User_Lamnbda;
+            arma::mat tmpdI;
+            if(ls_coef>0){
+                arma::sp_mat eye;
+                eye.eye(npt,npt);
+                tmpdI = inv(eye + lamnbda*K00);
+            }
+            if(!Set_OutOfCore_K(ooc_K, lamnbda, ls_coef>0 ? tmpdI : dI)){
+                cout<<"out-of-core K failed"<<endl;
+                return 0;
+            }
+        }else if(ls_coef>0){
             arma::sp_mat eye;
             eye.eye(npt,npt);
 
@@ -249,12 +718,12 @@ void RBF_Core::Set_HermiteApprox_Lamnda(double hermite_ls){
         cout<<"solved: "<<(std::chrono::nanoseconds(Clock::now() - t1).count()/1e9)<<endl;    
     }
 
-
+    return 1;
 }
 
 
 
-void RBF_Core::Set_Hermite_PredictNormal(vector<double>&pts){
+int RBF_Core::Set_Hermite_PredictNormal(vector<double>&pts){
 
 
 
@@ -270,6 +739,30 @@ void RBF_Core::Set_Hermite_PredictNormal(vector<double>&pts){
         K = K.submat( npt, npt, npt*4-1, npt*4-1 );
         finalH = saveK_finalH = K;
 
+    }else if(isoutofcore){
+        cout<<"using new formula, out-of-core"<<endl;
+        for(int i=0;i<npt*4;++i)for(int j=0;j<4;++j)
+            ooc_bigM(i,npt*4+j) = ooc_bigM(npt*4+j,i) = N(i,j);
+        for(int i=0;i<4;++i)for(int j=0;j<4;++j)ooc_bigM(npt*4+i,npt*4+j) = 0;
+
+        auto t2 = Clock::now();
+        if(!ooc_bigM.LDLT_Inverse()){
+            //as inv() throws in core: the factors are garbage, nothing below may use them
+            cout<<"out-of-core LDLT failed"<<endl;
+            ooc_bigM.Release();
+            return 0;
+        }
+        cout<<"bigMinv: "<<(setK_time= std::chrono::nanoseconds(Clock::now() - t2).count()/1e9)<<endl;
+
+        // Minv, Ninv, K01 and K11 stay in the mapping, only K00 is needed
+        // in core, for the inverses of the lambda terms
+        K00 = ooc_bigM.SubMat(0,0,npt-1,npt-1);
+
+        N.clear();
+
+        if(!Set_User_Lamnda_ToMatrix(User_Lamnbda_inject))return 0;
+
+        cout<<"K: "<<ooc_finalH.n_cols<<endl;
     }else{
         cout<<"using new formula"<<endl;
         bigM.zeros((npt+1)*4,(npt+1)*4);
@@ -285,6 +778,7 @@ void RBF_Core::Set_Hermite_PredictNormal(vector<double>&pts){
 		bigM.clear();
         Minv = bigMinv.submat(0,0,npt*4-1,npt*4-1);
         Ninv = bigMinv.submat(0,npt*4,(npt)*4-1, (npt+1)*4-1);
+        Cinv = bigMinv.submat(npt*4,npt*4,(npt+1)*4-1, (npt+1)*4-1);
 
         bigMinv.clear();
         //K = Minv - Ninv *(N.t()*Minv);
@@ -315,7 +809,7 @@ void RBF_Core::Set_Hermite_PredictNormal(vector<double>&pts){
 
     //K = ( K.t() + K )/2;
     cout<<"solve K total: "<<(setK_time= std::chrono::nanoseconds(Clock::now() - t1).count()/1e9)<<endl;
-    return;
+    return 1;
 
 }
 
@@ -333,7 +827,16 @@ int RBF_Core::Solve_Hermite_PredictNormal_UnitNorm(){
     arma::vec eigval, ny;
     arma::mat eigvec;
 
-    if(!isuse_sparse){
+    if(isoutofcore){
+        double eigval0 = 0;
+        if(!ooc_K.IsAllocated() || !ooc_K.Eig_Smallest(eigval0, ny)){
+            cout<<"out-of-core eigen initialization failed"<<endl;
+            return 0;
+        }
+        ooc_K.Release();
+        eigval = {eigval0};
+        eigvec = ny;
+    }else if(!isuse_sparse){
         ny = eig_sym( eigval, eigvec, K);
     }else{
 //		cout<<"use sparse eigen"<<endl;
@@ -404,7 +907,7 @@ double optfunc_Hermite(const vector<double>&x, vector<double>&grad, void *fdata)
     arma::vec a2;
     //if(drbf->isuse_sparse)a2 = drbf->sp_H * arma_x;
     //else
-    a2 = drbf->finalH * arma_x;
+    drbf->FinalH_MatVec(arma_x, a2);
 
 
     if (!grad.empty()) {
@@ -438,6 +941,10 @@ double optfunc_Hermite(const vector<double>&x, vector<double>&grad, void *fdata)
 
 int RBF_Core::Opt_Hermite_PredictNormal_UnitNormal(){
 
+    if(isoutofcore && !ooc_finalH.IsAllocated()){
+        cout<<"Opt_Hermite_PredictNormal_UnitNormal: no out-of-core finalH"<<endl;
+        return 0;
+    }
 
     sol.solveval.resize(npt * 2);
 
@@ -504,13 +1011,27 @@ void RBF_Core::Set_RBFCoef(arma::vec &y){
         a = Minv * (y - N*b);
     }else{
 
-        if(User_Lamnbda>0)y.subvec(0,npt-1) = -User_Lamnbda*dI*K01*y.subvec(npt,npt*4-1);
+        if(User_Lamnbda>0){
+            arma::vec t(npt);
+            if(isoutofcore)ooc_bigM.SubMatVec(0,npt,npt,npt*3,y.memptr()+npt,t.memptr());
+            else t = K01*y.subvec(npt,npt*4-1);
+            y.subvec(0,npt-1) = -User_Lamnbda*dI*t;
+        }
 
-        a = Minv*y;
-        b = Ninv.t()*y;
+        if(isoutofcore){
+            a.set_size(npt*4);
+            b.set_size(4);
+            ooc_bigM.SubMatVec(0,0,npt*4,npt*4,y.memptr(),a.memptr());
+            ooc_bigM.SubMatVec(npt*4,0,4,npt*4,y.memptr(),b.memptr());
+        }else{
+            a = Minv*y;
+            b = Ninv.t()*y;
+        }
 
     }
 
+    Build_HermiteField();
+
 
 }
 
@@ -531,14 +1052,14 @@ int RBF_Core::Lamnbda_Search_GlobalEigen(){
     lamnbda_list_sa = lamnbda_list;
     for(int i=0;i<lamnbda_list.size();++i){
 
-        Set_HermiteApprox_Lamnda(lamnbda_list[i]);
+        if(!Set_HermiteApprox_Lamnda(lamnbda_list[i]))return 0;
 
         if(curMethod==Hermite_UnitNormal){
-            Solve_Hermite_PredictNormal_UnitNorm();
+            if(!Solve_Hermite_PredictNormal_UnitNorm())return 0;
         }
 
         //Solve_Hermite_PredictNormal_UnitNorm();
-        OptNormal(1);
+        if(!OptNormal(1))return 0;
 
         initen_list[i] = sol.init_energy;
         finalen_list[i] = sol.energy;
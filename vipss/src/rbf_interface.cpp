@@ -11,10 +11,12 @@
 #include "ImplicitedSurfacing.h"
 typedef std::chrono::high_resolution_clock Clock;
 
-void RBF_Core::BuildK(RBF_Paras para){
+int RBF_Core::BuildK(RBF_Paras para){
 
     isuse_sparse = para.isusesparse;
     sparse_para = para.sparse_para;
+    isoutofcore = para.isoutofcore;
+    outofcore_dir = para.outofcore_dir;
     Hermite_weight_smoothness = para.Hermite_weight_smoothness;
     Hermite_designcurve_weight = para.Hermite_designcurve_weight;
 //    handcraft_sigma = para.handcraft_sigma;
@@ -33,7 +35,10 @@ void RBF_Core::BuildK(RBF_Paras para){
     switch(curMethod){
 
     case Hermite_UnitNormal:
-        Set_Hermite_PredictNormal(pts);
+        if(!Set_Hermite_PredictNormal(pts)){
+            cout<<"BuildK failed"<<endl;
+            return 0;
+        }
         break;
     }
     auto t2 = Clock::now();
@@ -41,9 +46,10 @@ void RBF_Core::BuildK(RBF_Paras para){
 
 
     if(0)BuildCoherentGraph();
+    return 1;
 }
 
-void RBF_Core::InitNormal(RBF_Paras para){
+int RBF_Core::InitNormal(RBF_Paras para){
 
 
     auto t1 = Clock::now();
@@ -52,7 +58,10 @@ void RBF_Core::InitNormal(RBF_Paras para){
     switch(curInitMethod){
 
     case Lamnbda_Search:
-        Lamnbda_Search_GlobalEigen();
+        if(!Lamnbda_Search_GlobalEigen()){
+            cout<<"InitNormal failed"<<endl;
+            return 0;
+        }
         break;
 
     }
@@ -63,10 +72,11 @@ void RBF_Core::InitNormal(RBF_Paras para){
     cout << "Init Time: " << (init_time = std::chrono::nanoseconds(t2 - t1).count()/1e9) << endl<< endl;
 
     mp_RBF_InitNormal[curMethod==HandCraft?0:1][curInitMethod] = initnormals;
+    return 1;
 
 }
 
-void RBF_Core::OptNormal(int method){
+int RBF_Core::OptNormal(int method){
 
     cout<<"OptNormal"<<endl;
     auto t1 = Clock::now();
@@ -75,26 +85,54 @@ void RBF_Core::OptNormal(int method){
     switch(curMethod){
 
     case Hermite_UnitNormal:
-        Opt_Hermite_PredictNormal_UnitNormal();
+        if(!Opt_Hermite_PredictNormal_UnitNormal())return 0;
         break;
 
     }
     auto t2 = Clock::now();
     cout << "Opt Time: " << (solve_time = std::chrono::nanoseconds(t2 - t1).count()/1e9) << endl<< endl;
     if(method==0)mp_RBF_OptNormal[curMethod==HandCraft?0:1][curInitMethod] = newnormals;
+    return 1;
 }
 
 
 void RBF_Core::Surfacing(int method, int n_voxels_1d){
 
+    if(!IsSolved()){
+        cout<<"Surfacing: the model is not solved, call OptNormal after InsertPoints/RemovePoints"<<endl;
+        return;
+    }
     n_evacalls = 0;
     Surfacer sf;
     double re_time;
-
-    re_time = sf.Surfacing_Implicit(pts,n_voxels_1d,true,RBF_Core::Dist_Function);
+    sf.isadaptive = isadaptivesurfacing;
+    sf.ismarchingcubes = ismarchingcubes;
+    sf.data_distance = surfacing_datadistance;
+    sf.isgradientmagnitude = issurfacinggradient;
+
+    //the block polygonizer calls the field from several threads, which only the extracted field supports;
+    //without it (not Hermite/XCube) the engines take finite differences for the normals
+    const vector<double> *p_normals = newnormals.size()==pts.size() ? &newnormals : NULL;
+    if(!streamsurfacing_fname.empty()){
+        if(field.IsValid())re_time = sf.Surfacing_Streamed(pts,n_voxels_1d,streamsurfacing_fname,RBF_Core::Dist_Function,RBF_Core::Dist_Gradient,RBF_Core::Dist_Function_Batch,RBF_Core::Dist_TaylorBound);
+        else re_time = sf.Surfacing_Streamed(pts,n_voxels_1d,streamsurfacing_fname,RBF_Core::Dist_Function,NULL);
+        finalMesh_v.clear();
+        finalMesh_fv.clear();
+        finalMesh_vn.clear();
+        finalMesh_vgradnorm.clear();
+        if(re_time<0)cout<<"streamed surfacing failed, "<<streamsurfacing_fname<<".ply is incomplete"<<endl;
+        cout<<"n_evacalls: "<<n_evacalls<<endl;
+        return;
+    }
+    if(n_progressivelevels>0){
+        if(field.IsValid())re_time = sf.Surfacing_Progressive(pts,n_voxels_1d,n_progressivelevels,progressivesurfacing_fname,true,RBF_Core::Dist_Function,RBF_Core::Dist_Gradient,RBF_Core::Dist_Function_Batch,p_normals,RBF_Core::Dist_TaylorBound);
+        else re_time = sf.Surfacing_Progressive(pts,n_voxels_1d,n_progressivelevels,progressivesurfacing_fname,true,RBF_Core::Dist_Function,NULL,NULL,p_normals);
+    }
+    else if(field.IsValid())re_time = sf.Surfacing_Implicit(pts,n_voxels_1d,true,RBF_Core::Dist_Function,RBF_Core::Dist_Gradient,RBF_Core::Dist_Function_Batch,p_normals,RBF_Core::Dist_TaylorBound);
+    else re_time = sf.Surfacing_Implicit(pts,n_voxels_1d,true,RBF_Core::Dist_Function,NULL,NULL,p_normals);
 
 
-    sf.WriteSurface(finalMesh_v,finalMesh_fv);
+    sf.WriteSurface(finalMesh_v,finalMesh_fv,finalMesh_vn,finalMesh_vgradnorm);
 
     cout<<"n_evacalls: "<<n_evacalls<<"   ave: "<<re_time/n_evacalls<<endl;
 
@@ -123,6 +161,7 @@ int RBF_Core::InjectData(vector<double> &pts, vector<int> &labels, vector<double
     this->tangents = tangents;
     this->edges = edges;
     npt = this->pts.size()/3;
+    Set_PtsSoA();
     curMethod = para.Method;
     curInitMethod = para.InitMethod;
 
@@ -146,9 +185,7 @@ int RBF_Core::InjectData(vector<double> &pts, vector<int> &labels, vector<double
 int RBF_Core::ThreeStep(vector<double>&pts, vector<int>&labels, vector<double>&normals, vector<double>&tangents,  vector<uint>&edges, RBF_Paras para){
 
     InjectData(pts, labels, normals, tangents, edges,  para);
-    BuildK(para);
-    InitNormal(para);
-    OptNormal(0);
+    if(!BuildK(para) || !InitNormal(para) || !OptNormal(0))return 0;
 	
 	return 1;
 }
@@ -157,9 +194,7 @@ int RBF_Core::ThreeStep(vector<double>&pts, vector<int>&labels, vector<double>&n
 int RBF_Core::AllStep(vector<double> &pts, vector<int> &labels, vector<double> &normals, vector<double> &tangents, vector<uint> &edges, RBF_Paras para){
 
     InjectData(pts, labels, normals, tangents, edges,  para);
-    BuildK(para);
-    InitNormal(para);
-    OptNormal(0);
+    if(!BuildK(para) || !InitNormal(para) || !OptNormal(0))return 0;
     Surfacing(0,100);
 	return 1;
 
@@ -168,12 +203,11 @@ int RBF_Core::AllStep(vector<double> &pts, vector<int> &labels, vector<double> &
 void RBF_Core::BatchInitEnergyTest(vector<double> &pts, vector<int> &labels, vector<double> &normals, vector<double> &tangents, vector<uint> &edges, RBF_Paras para){
 
     InjectData(pts, labels, normals, tangents, edges,  para);
-    BuildK(para);
+    if(!BuildK(para))return;
     para.ClusterVisualMethod = 0;//RBF_Init_EMPTY
     for(int i=0;i<RBF_Init_EMPTY;++i){
         para.InitMethod = RBF_InitMethod(i);
-        InitNormal(para);
-        OptNormal(0);
+        if(!InitNormal(para) || !OptNormal(0))return;
         Record();
     }
     Print_Record_Init();
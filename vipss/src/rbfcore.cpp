@@ -1,6 +1,7 @@
 #include "rbfcore.h"
 #include "utility.h"
 #include "Solver.h"
+#include "kernelbatch.h"
 #include <armadillo>
 #include <fstream>
 #include <limits>
@@ -100,6 +101,26 @@ void XCube_Hessian_Kernel_2p(const double *p1, const double *p2, double *H){
 
 }
 
+void XCube_FGH_Kernel_2p(const double *p1, const double *p2, double *F, double *G, double *H){
+
+    //value, gradient and Hessian of |p1-p2|^3 sharing one distance evaluation
+    double diff[3];
+    for(int i=0;i<3;++i)diff[i] = p1[i] - p2[i];
+    double len_dist  = sqrt(MyUtility::len(diff));
+
+    *F = len_dist * len_dist * len_dist;
+    for(int i=0;i<3;++i)G[i] = 3*len_dist*diff[i];
+    if(len_dist<1e-8){
+        for(int i=0;i<9;++i)H[i] = 0;
+    }else{
+        double inv_len = 3 / len_dist;
+        for(int i=0;i<3;++i)for(int j=0;j<3;++j)
+            H[i*3+j] = inv_len * diff[i] * diff[j];
+        for(int i=0;i<3;++i)H[i*3+i] += 3 * len_dist;
+    }
+
+}
+
 void XCube_HessianDot_Kernel_2p(const double *p1, const double *p2, const double *p3, vector<double>&dotout){
 
 
@@ -120,6 +141,7 @@ RBF_Core::RBF_Core(){
     Kernal_Function = Gaussian_Kernel;
     Kernal_Function_2p = Gaussian_Kernel_2p;
     P_Function_2p = Gaussian_PKernel_Dirichlet_2p;
+    Kernal_FGH_Function_2p = NULL;
 
     isHermite = false;
 
@@ -165,6 +187,7 @@ void RBF_Core::Init(RBF_Kernal kernal){
         Kernal_Function = Gaussian_Kernel;
         Kernal_Function_2p = Gaussian_Kernel_2p;
         P_Function_2p = Gaussian_PKernel_Dirichlet_2p;
+        Kernal_FGH_Function_2p = NULL;
         break;
 
     case XCube:
@@ -172,6 +195,7 @@ void RBF_Core::Init(RBF_Kernal kernal){
         Kernal_Function_2p = XCube_Kernel_2p;
         Kernal_Gradient_Function_2p = XCube_Gradient_Kernel_2p;
         Kernal_Hessian_Function_2p = XCube_Hessian_Kernel_2p;
+        Kernal_FGH_Function_2p = XCube_FGH_Kernel_2p;
         break;
 
     default:
@@ -197,10 +221,27 @@ double RBF_Core::Dist_Function(const double x, const double y, const double z){
 
 double RBF_Core::Dist_Function(const double *p){
 
+    #pragma omp atomic
     n_evacalls++;
+    //cached values (an interpolant with a sampled error estimate) take precedence
+    //over the certified single precision sign
+    if(cache.IsValid()){
+        double re;
+        if(cache.Value(p,re))return re;
+    }
+    if(field.HasSinglePrecision())return field.Value_SignCertified(p);
+    if(field.IsValid())return field.Value(p);
+    if(!IsSolved())return numeric_limits<double>::quiet_NaN();
+
     double *p_pts = pts.data();
     static arma::vec kern(npt), kb;
-    if(isHermite){
+    if(isHermite && kernal==XCube && pts_soa.size()==size_t(npt)*3){
+        //the batched outputs are already in the [a, gx, gy, gz] layout of kern
+        kern.set_size(npt*4);
+        double *p_kern = kern.memptr();
+        double *G[3] = {p_kern+npt, p_kern+npt*2, p_kern+npt*3};
+        XCube_FG_Kernel_Batch(p, pts_soa.data(), pts_soa.data()+npt, pts_soa.data()+npt*2, npt, p_kern, G);
+    }else if(isHermite){
         kern.set_size(npt*4);
         double G[3];
         for(int i=0;i<npt;++i)kern(i) = Kernal_Function_2p(p_pts+i*3, p);
@@ -216,18 +257,7 @@ double RBF_Core::Dist_Function(const double *p){
 
     double loc_part = dot(kern,a);
 
-    if(polyDeg==1){
-        kb.set_size(4);
-        for(int i=0;i<3;++i)kb(i+1) = p[i];
-        kb(0) = 1;
-    }else if(polyDeg==2){
-        vector<double>buf(4,1);
-        int ind = 0;
-        kb.set_size(10);
-        for(int j=0;j<3;++j)buf[j+1] = p[j];
-        for(int j=0;j<4;++j)for(int k=j;k<4;++k)kb(ind++) = buf[j] * buf[k];
-    }
-    double poly_part = dot(kb,b);
+    double poly_part = Poly_Function(p);
 
     if(0){
         cout<<"dist: "<<p[0]<<' '<<p[1]<<' '<<p[2]<<' '<<p_pts[3]<<' '<<p_pts[4]<<' '<<p_pts[5]<<' '<<
@@ -242,11 +272,175 @@ double RBF_Core::Dist_Function(const double *p){
 
 
 }
+
+bool RBF_Core::IsSolved() const{
+
+    return field.IsValid() || (a.n_elem>0 && a.n_elem==size_t(npt)*(isHermite?4:1));
+}
+
+double RBF_Core::Poly_Function(const double *p) const{
+
+    if(polyDeg==1){
+        return b(0) + b(1)*p[0] + b(2)*p[1] + b(3)*p[2];
+    }else if(polyDeg==2){
+        double buf[4] = {1, p[0], p[1], p[2]};
+        double re = 0;
+        int ind = 0;
+        for(int j=0;j<4;++j)for(int k=j;k<4;++k)re += b(ind++) * buf[j] * buf[k];
+        return re;
+    }
+    return 0;
+}
+
+void RBF_Core::Poly_Gradient(const double *p, double *grad) const{
+
+    for(int i=0;i<3;++i)grad[i] = 0;
+    if(polyDeg==1){
+        for(int i=0;i<3;++i)grad[i] = b(i+1);
+    }else if(polyDeg==2){
+        double buf[4] = {1, p[0], p[1], p[2]};
+        int ind = 0;
+        for(int j=0;j<4;++j)for(int k=j;k<4;++k){
+            if(j>0)grad[j-1] += b(ind) * buf[k];
+            if(k>0)grad[k-1] += b(ind) * buf[j];
+            ++ind;
+        }
+    }
+}
+
+double RBF_Core::Dist_ValueAndGradient(const double *p, double *grad){
+
+    if(field.IsValid())return field.ValueAndGradient(p,grad);
+
+    //the closed form below needs Hermite coefficients and the kernel Hessian;
+    //anything else gets central differences
+    if(!isHermite || a.n_elem!=size_t(npt)*4 || Kernal_Gradient_Function_2p==NULL || Kernal_Hessian_Function_2p==NULL){
+        double q[3] = {p[0],p[1],p[2]};
+        for(int j=0;j<3;++j){
+            const double h = 1e-6*max(1.,fabs(p[j]));
+            q[j] = p[j]+h;
+            double fp = Dist_Function(q);
+            q[j] = p[j]-h;
+            double fm = Dist_Function(q);
+            q[j] = p[j];
+            grad[j] = (fp-fm)/(2*h);
+        }
+        return Dist_Function(q);
+    }
+
+    //f = sum a_i phi(p,x_i) + g_i . grad phi(p,x_i), so
+    //grad f = sum a_i grad phi(p,x_i) + hess phi(p,x_i) g_i
+    const double *p_a = a.memptr();
+    const double *p_g[3] = {p_a+npt, p_a+npt*2, p_a+npt*3};
+    const double *p_pts = pts.data();
+    double re = 0, G[3], H[9];
+    for(int j=0;j<3;++j)grad[j] = 0;
+    for(int i=0;i<npt;++i){
+        Kernal_Gradient_Function_2p(p,p_pts+i*3,G);
+        Kernal_Hessian_Function_2p(p,p_pts+i*3,H);
+        re += p_a[i]*Kernal_Function_2p(p_pts+i*3, p);
+        for(int j=0;j<3;++j){
+            re += p_g[j][i]*G[j];
+            grad[j] += p_a[i]*G[j];
+            for(int k=0;k<3;++k)grad[j] += H[j*3+k]*p_g[k][i];
+        }
+    }
+
+    double pgrad[3];
+    Poly_Gradient(p,pgrad);
+    for(int j=0;j<3;++j)grad[j] += pgrad[j];
+
+    return re + Poly_Function(p);
+}
+
+void RBF_Core::Dist_Gradient(const double *p, double *grad){
+
+    Dist_ValueAndGradient(p,grad);
+}
+
+void RBF_Core::Dist_Function_Batch(const double *p, size_t m, double *out){
+
+    #pragma omp atomic
+    n_evacalls += m;
+    if(field.IsValid()){
+        if(!cache.IsValid() && !field.HasSinglePrecision()){
+            field.Value_Batch(p,m,out);
+            return;
+        }
+        //as Dist_Function: the cache, then the certified single precision sum, then double
+        const long n = m;
+        #pragma omp parallel for schedule(dynamic,16)
+        for(long i=0;i<n;++i){
+            const double *q = p+i*3;
+            if(cache.IsValid() && cache.Value(q,out[i]))continue;
+            out[i] = field.HasSinglePrecision() ? field.Value_SignCertified(q) : field.Value(q);
+        }
+        return;
+    }
+    for(size_t i=0;i<m;++i)out[i] = Dist_Function(p+i*3);
+}
+
+void RBF_Core::Build_HermiteField(){
+
+    cache.Clear();
+    if(!isHermite || kernal!=XCube || a.n_elem!=npt*4){
+        field.Clear();
+        return;
+    }
+    field.Set(pts, a.memptr(), b.memptr(), polyDeg);
+    field.Set_SinglePrecision(ismixedprecision);
+    cout<<"HermiteField: "<<npt<<" centers, "<<field.MemoryBytes()/1e6<<" MB"<<endl;
+}
+
+void RBF_Core::Build_FieldCache(int n_cells_1d, int band){
+
+    if(!field.IsValid() || n_cells_1d<=0)return;
+    double maxlen = 0;
+    for(int j=0;j<3;++j)maxlen = max(maxlen, field.bbox[j+3]-field.bbox[j]);
+    double h = maxlen/n_cells_1d;
+
+    //interpolation may move the zero level set by 1% of a cell
+    cache.Build(field, pts, h, band, 0.01*h);
+}
+
+void RBF_Core::Set_MixedPrecision(bool on){
+
+    ismixedprecision = on;
+    field.Set_SinglePrecision(on);
+}
+
+void RBF_Core::Release_SolverMatrices(){
+
+    //everything but pts/a/b, which the field and the exports still use
+    arma::mat *mats[] = {&M, &N, &Minv, &P, &K, &bprey, &saveK, &saveK_finalH, &finalH, &RQ,
+                         &bigM, &bigMinv, &Ninv, &Cinv, &K00, &K01, &K11, &dI};
+    for(arma::mat *pm: mats)pm->reset();
+    ooc_bigM.Release();
+    ooc_finalH.Release();
+    ooc_K.Release();
+    cout<<"Release_SolverMatrices"<<endl;
+}
 static RBF_Core * s_hrbf;
 double RBF_Core::Dist_Function(const R3Pt &in_pt){
     return s_hrbf->Dist_Function(&(in_pt[0]));
 }
 
+void RBF_Core::Dist_Gradient(const R3Pt &in_pt, R3Vec &out_vec){
+    double grad[3];
+    s_hrbf->Dist_Gradient(&(in_pt[0]),grad);
+    for(int j=0;j<3;++j)out_vec[j] = grad[j];
+}
+
+void RBF_Core::Dist_Function_Batch(const R3Pt *in_pts, size_t m, double *out){
+    static_assert(sizeof(R3Pt)==3*sizeof(double), "R3Pt is not three packed doubles");
+    s_hrbf->Dist_Function_Batch(&(in_pts[0][0]),m,out);
+}
+
+double RBF_Core::Dist_TaylorBound(const R3Pt &in_pt, const R3Vec &in_half, double *out_model){
+    const double half[3] = {in_half[0], in_half[1], in_half[2]};
+    return s_hrbf->field.Taylor_Bound(&(in_pt[0]), half, out_model, out_model+1, out_model+4);
+}
+
 //FT RBF_Core::Dist_Function(const Point_3 in_pt){
 
 //    return s_hrbf->Dist_Function(&(in_pt.x()));
@@ -257,11 +451,48 @@ void RBF_Core::SetThis(){
     s_hrbf = this;
 }
 
+void RBF_Core::Set_PtsSoA(){
+
+    //x, y and z coordinates in three contiguous runs, for the batched kernels
+    pts_soa.resize(npt*3);
+    for(int i=0;i<npt;++i)
+        for(int j=0;j<3;++j)pts_soa[j*npt+i] = pts[i*3+j];
+
+    //the centers changed, the extracted field is stale until the next Set_RBFCoef
+    field.Clear();
+    cache.Clear();
+}
+
 void RBF_Core::Write_Surface(string fname){
 
     //writeObjFile(fname,finalMesh_v,finalMesh_fv);
 
-    writePLYFile_VF(fname,finalMesh_v,finalMesh_fv);
+    writePLYFile_VFN(fname,finalMesh_v,finalMesh_fv,finalMesh_vn,finalMesh_vgradnorm);
+}
+
+bool RBF_Core::Write_Model(string fname){
+
+    if(!field.IsValid()){
+        cout<<"Write_Model: no solved Hermite field"<<endl;
+        return false;
+    }
+    return field.Save(fname);
+}
+
+bool RBF_Core::Read_Model(string fname){
+
+    if(!field.Load(fname))return false;
+
+    //enough state for Surfacing and the Dist_* queries, no solver
+    Init(XCube);
+    isHermite = true;
+    npt = field.npt;
+    polyDeg = field.polyDeg;
+    pts.resize(npt*3);
+    for(int i=0;i<npt;++i)
+        for(int j=0;j<3;++j)pts[i*3+j] = field.Stream(j)[i];
+
+    return true;
 }
 
 /**********************************************************/
@@ -8,6 +8,9 @@
 #include <vector>
 #include "Solver.h"
 #include "ImplicitedSurfacing.h"
+#include "mmapmatrix.h"
+#include "hermitefield.h"
+#include "fieldcache.h"
 //#include "eigen3/Eigen/Dense"
 #include <armadillo>
 #include <unordered_map>
@@ -73,6 +76,8 @@ public:
     double user_lamnbda;
     double rangevalue;
     double sparse_para = 1e-3;
+    bool isoutofcore = false;
+    string outofcore_dir;
     double Hermite_weight_smoothness;
     double Hermite_ls_weight;
     double Hermite_designcurve_weight;
@@ -109,6 +114,7 @@ public:
     double maxvalue = 10000;
 
     vector<double>pts;
+    vector<double>pts_soa;
     vector<double>normals;
     vector<double>tangents;
     vector<uint>edges;
@@ -131,6 +137,8 @@ public:
 public:
     vector<double>finalMesh_v;
     vector<uint>finalMesh_fv;
+    vector<double>finalMesh_vn;          //analytic unit normals, facing as the triangles
+    vector<double>finalMesh_vgradnorm;   //|grad f| at the vertices, if issurfacinggradient
 
 public:
 
@@ -153,6 +161,7 @@ public:
     arma::mat bigM;
     arma::mat bigMinv;
     arma::mat Ninv;
+    arma::mat Cinv;
     arma::mat K00;
     arma::mat K01;
     arma::mat K11;
@@ -162,6 +171,21 @@ public:
     bool isuse_sparse = false;
     double sparse_para = 1e-3;
 
+    bool isoutofcore = false;
+    string outofcore_dir;
+    MMap_Matrix ooc_bigM;
+    MMap_Matrix ooc_finalH;     //finalH of the optimizer, out of core
+    MMap_Matrix ooc_K;          //K of the eigen initialization, overwritten by it
+
+    //compact evaluator extracted by Set_RBFCoef (Hermite, XCube); Dist_* forward to it
+    HermiteField field;
+
+    //optional narrow-band lattice of the field, checked first by Dist_Function
+    FieldCache cache;
+
+    //Dist_Function in float32 with a certified sign (see HermiteField::Value_SignCertified)
+    bool ismixedprecision = false;
+
 public:
     unordered_map<int, string>mp_RBF_INITMETHOD;
     unordered_map<int, string>mp_RBF_METHOD;
@@ -186,6 +210,7 @@ public:
     double ls_coef;
     void (*Kernal_Gradient_Function_2p)(const double *p1, const double *p2, double *G);
     void (*Kernal_Hessian_Function_2p)(const double *p1, const double *p2, double *H);
+    void (*Kernal_FGH_Function_2p)(const double *p1, const double *p2, double *F, double *G, double *H);
 
 private:
     vector<double>local_eigenBe, local_eigenEd, eigenBe, eigenEd, gtBe, gtEd;
@@ -209,12 +234,33 @@ public:
     double Dist_Function(const double x, const double y, const double z);
     double Dist_Function(const double *p);
 
+    //false from InsertPoints/RemovePoints until the next OptNormal, while the coefficients
+    //belong to the old points; Dist_Function then returns NaN and Surfacing refuses
+    bool IsSolved() const;
+
+    //m queries (xyz interleaved) at once, tiled and multithreaded; thread safe
+    void Dist_Function_Batch(const double *p, size_t m, double *out);
+
+    //analytic field gradient from the kernel gradient/Hessian of a Hermite fit, central
+    //differences otherwise; thread safe with the extracted field
+    void Dist_Gradient(const double *p, double *grad);
+    double Dist_ValueAndGradient(const double *p, double *grad);
+
+private:
+    double Poly_Function(const double *p) const;
+    void Poly_Gradient(const double *p, double *grad) const;
+
 public:
     static double Dist_Function(const R3Pt &in_pt);
+    static void Dist_Gradient(const R3Pt &in_pt, R3Vec &out_vec);
+    static void Dist_Function_Batch(const R3Pt *in_pts, size_t m, double *out);
+    //quadratic model of the field over a box and its error bound, see HermiteField::Taylor_Bound
+    static double Dist_TaylorBound(const R3Pt &in_pt, const R3Vec &in_half, double *out_model);
     //static FT Dist_Function(const Point_3 in_pt);
     int n_evacalls;
 public:
     void SetThis();
+    void Set_PtsSoA();
 public:
 
     void SetSigma(double x);
@@ -229,10 +275,44 @@ public:
 
 public:
     void Set_HermiteRBF(vector<double>&pts);
+    void Set_HermiteBlock(const double *p_r, int nr, const double *p_c, int nc, arma::mat &Mb);
     int Solve_HermiteRBF(vector<double>&vn);
 
+    //append points to a solved system by a bordered update of Minv/Ninv/Cinv, O(kN^2);
+    //the normals are warm-started, call OptNormal afterwards to re-optimize
+    int InsertPoints(vector<double>&newpts);
+
+    //drop points by downdating Minv/Ninv/Cinv, O(kN^2); the normals of the kept points are warm-started
+    int RemovePoints(vector<int>&rmind);
+
+    //max difference of Minv/Ninv/Cinv to the inverse of the saddle system assembled and
+    //inverted from scratch for the current points, relative to its max entry; O(N^3),
+    //a check of InsertPoints/RemovePoints on small point sets
+    double Check_InverseBlocks();
+
+    //leave-one-out residuals from the 4x4 diagonal blocks of Minv (block Rippa formula):
+    //per point, the field value and gradient misfit of the fit without that point
+    //(the gradient part follows the gradient rows of M, which hold -grad f).
+    //Minv is the point block of the inverse of the bordered system [M N; N^T 0], so the
+    //refit keeps the polynomial and Ninv/Cinv are not needed. The refit solves for the
+    //same right-hand side as a, b: the normals of the other points stay as they are (not
+    //re-optimized) and a user lambda term is held at its current value
+    int LeaveOneOut_Residuals(vector<double>&res_value, vector<double>&res_gradient);
+
+    //print the k points with the largest leave-one-out value residuals and drop them
+    //with RemovePoints; call OptNormal afterwards
+    int RemoveOutliers(int k);
+
+    //max difference of LeaveOneOut_Residuals to explicit refits without each of the
+    //first ncheck points; O(ncheck N^3), for small point sets
+    double Check_LeaveOneOut(int ncheck);
+
+private:
+    void Get_bigMinv(arma::mat &Z);
+    void Set_HermiteInverseBlocks(arma::mat &Z);
+
 public:
-    void Set_Hermite_PredictNormal(vector<double>&pts);
+    int Set_Hermite_PredictNormal(vector<double>&pts);
 
 public:
 
@@ -255,14 +335,28 @@ public:
 
 
     void Set_RBFCoef(arma::vec &y);
+    void Build_HermiteField();
+
+    //cache the field around the points on a lattice with n_cells_1d cells along
+    //the longest side of the bounding box (see FieldCache)
+    void Build_FieldCache(int n_cells_1d, int band = 1);
+
+    void Set_MixedPrecision(bool on);
+
+    //free the O(N^2) solver matrices once the coefficients are set; the field
+    //still evaluates, but InsertPoints/RemovePoints/OptNormal need a new BuildK
+    void Release_SolverMatrices();
 
     void Set_Actual_Hermite_LSCoef(double hermite_ls);
-    void Set_HermiteApprox_Lamnda(double hermite_ls);
+    int Set_HermiteApprox_Lamnda(double hermite_ls);
     void Set_Actual_User_LSCoef(double user_ls);
-    void Set_User_Lamnda_ToMatrix(double user_ls);
+    int Set_User_Lamnda_ToMatrix(double user_ls);
 
     void Set_SparsePara(double spa);
 
+    void FinalH_MatVec(const arma::vec &x, arma::vec &y);
+    bool Set_OutOfCore_K(MMap_Matrix &dst, double lamnbda, const arma::mat &lamnbda_dI);
+
 
 public:
 
@@ -276,6 +370,11 @@ public:
 
     void Write_Surface(string fname);
 
+    //solved field as a binary model (see HermiteField); Read_Model maps it and
+    //sets up pts so that Surfacing runs without BuildK/OptNormal
+    bool Write_Model(string fname);
+    bool Read_Model(string fname);
+
 public:
 
     int Opt_Hermite_PredictNormal_UnitNormal();
@@ -289,14 +388,36 @@ public:
 
     int InjectData(vector<double> &pts, RBF_Paras para);
 
-    void BuildK(RBF_Paras para);
+    int BuildK(RBF_Paras para);
 
-    void InitNormal(RBF_Paras para);
+    int InitNormal(RBF_Paras para);
 
-    void OptNormal(int method);
+    int OptNormal(int method);
 
     void Surfacing(int method, int n_voxels_1d);
 
+    //Surfacing on an adaptive octree instead of the uniform lattice
+    bool isadaptivesurfacing = false;
+
+    //Surfacing by the marching cubes table instead of six tetrahedra per cube
+    bool ismarchingcubes = false;
+
+    //if >0, Surfacing only meshes within this fraction of the width of the points' bounding box
+    //of an input point, and skips the field everywhere else
+    double surfacing_datadistance = 0;
+
+    //Surfacing also exports the gradient magnitude of the function at the mesh vertices
+    bool issurfacinggradient = false;
+
+    //if set, Surfacing streams the mesh slab by slab to the binary PLY streamsurfacing_fname+".ply",
+    //in bounded memory, and finalMesh_v/finalMesh_fv/finalMesh_vn stay empty
+    string streamsurfacing_fname;
+
+    //if >0, Surfacing first meshes n_progressivelevels coarser lattices, each half as fine as
+    //the next, written to progressivesurfacing_fname+"_<resolution>.ply", and reuses their values
+    int n_progressivelevels = 0;
+    string progressivesurfacing_fname;
+
     void BuildCoherentGraph();
 
     void BatchInitEnergyTest(vector<double> &pts, vector<int> &labels, vector<double> &normals, vector<double> &tangents, vector<uint> &edges, RBF_Paras para);
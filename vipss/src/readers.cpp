@@ -4,6 +4,8 @@
 #include<fstream>
 #include<sstream>
 #include<assert.h>
+#include<string.h>
+#include<stdint.h>
 using namespace std;
 
 bool readOffFile(string filename,vector<double>&vertices,vector<unsigned int>&faces2vertices){
@@ -180,6 +182,59 @@ bool writePLYFile_VF(string filename,const vector<double>&vertices,const vector<
 }
 
 
+bool writePLYFile_VFN(string filename,const vector<double>&vertices,const vector<unsigned int>&faces2vertices,
+                      const vector<double>&vertices_normal,const vector<double>&vertices_field){
+    filename = filename + ".ply";
+    ofstream outer(filename.data(), ofstream::out);
+    if (!outer.good()) {
+        cout << "Can not create output PLY file " << filename << endl;
+        return false;
+    }
+
+
+    int n_vertices = vertices.size()/3;
+    int n_faces = faces2vertices.size()/3;
+    bool isnormal = vertices_normal.size() == vertices.size();
+    bool isfield = vertices_field.size()*3 == vertices.size() && n_vertices > 0;
+    outer << "ply" <<endl;
+    outer << "format ascii 1.0"<<endl;
+    outer << "element vertex " << n_vertices <<endl;
+    outer << "property float x" <<endl;
+    outer << "property float y" <<endl;
+    outer << "property float z" <<endl;
+    if(isnormal){
+        outer << "property float nx" <<endl;
+        outer << "property float ny" <<endl;
+        outer << "property float nz" <<endl;
+    }
+    if(isfield)outer << "property float quality" <<endl;
+    outer << "element face " << n_faces <<endl;
+    outer << "property list uchar int vertex_indices" <<endl;
+    outer << "end_header" <<endl;
+
+    for(int i=0;i<n_vertices;++i){
+        auto p_v = vertices.data()+i*3;
+        for(int j=0;j<3;++j)outer << p_v[j] << " ";
+        if(isnormal){
+            auto p_vn = vertices_normal.data()+i*3;
+            for(int j=0;j<3;++j)outer << p_vn[j] << " ";
+        }
+        if(isfield)outer << vertices_field[i] << " ";
+        outer << endl;
+    }
+
+    for(int i=0;i<n_faces;++i){
+        auto p_fv = faces2vertices.data()+i*3;
+        outer << "3 ";
+        for(int j=0;j<3;++j)outer << p_fv[j] << " ";
+        outer << endl;
+    }
+    outer.close();
+    cout<<"saving finish: "<<filename<<endl;
+    return true;
+}
+
+
 bool writePLYFile_VN(string filename,const vector<double>&vertices, const vector<double>&vertices_normal){
     filename = filename + ".ply";
     ofstream outer(filename.data(), ofstream::out);
@@ -215,6 +270,87 @@ bool writePLYFile_VN(string filename,const vector<double>&vertices, const vector
 
 
 
+#define PLYSTREAM_COUNTWIDTH 12
+
+bool openPLYStream(string filename, PLYStream &ps, bool isnormal, bool isfield){
+    ps.filename = filename + ".ply";
+    ps.fp = fopen(ps.filename.data(), "wb");
+    if (ps.fp == NULL) {
+        cout << "Can not create output PLY file " << ps.filename << endl;
+        return false;
+    }
+    ps.fp_faces = tmpfile();
+    if (ps.fp_faces == NULL) {
+        cout << "Can not create a temporary file for " << ps.filename << endl;
+        fclose(ps.fp);
+        ps.fp = NULL;
+        return false;
+    }
+    ps.n_vertices = ps.n_faces = 0;
+    ps.isnormal = isnormal;
+    ps.isfield = isfield;
+
+    //the counts are unknown yet, leave fixed width room for them
+    fprintf(ps.fp, "ply\nformat binary_little_endian 1.0\n");
+    ps.vertexcountpos = ftell(ps.fp);
+    fprintf(ps.fp, "element vertex %*ld\n", PLYSTREAM_COUNTWIDTH, 0L);
+    fprintf(ps.fp, "property float x\nproperty float y\nproperty float z\n");
+    if (isnormal) fprintf(ps.fp, "property float nx\nproperty float ny\nproperty float nz\n");
+    if (isfield) fprintf(ps.fp, "property float quality\n");
+    ps.facecountpos = ftell(ps.fp);
+    fprintf(ps.fp, "element face %*ld\n", PLYSTREAM_COUNTWIDTH, 0L);
+    fprintf(ps.fp, "property list uchar uint vertex_indices\nend_header\n");
+    return true;
+}
+
+//native byte order, little endian on the platforms we build for
+void writePLYStreamVertex(PLYStream &ps, const double *v, const double *vn, double field){
+    float fv[7] = {float(v[0]), float(v[1]), float(v[2])};
+    int n = 3;
+    if (ps.isnormal) for(int j=0;j<3;++j) fv[n++] = vn ? float(vn[j]) : 0.f;
+    if (ps.isfield) fv[n++] = float(field);
+    fwrite(fv, sizeof(float), n, ps.fp);
+    ++ps.n_vertices;
+}
+
+void writePLYStreamFace(PLYStream &ps, const unsigned int *fv){
+    unsigned char buf[13];
+    buf[0] = 3;
+    for(int j=0;j<3;++j){
+        uint32_t id = fv[j];
+        memcpy(buf+1+j*4, &id, 4);
+    }
+    fwrite(buf, 1, 13, ps.fp_faces);
+    ++ps.n_faces;
+}
+
+bool closePLYStream(PLYStream &ps){
+    if (ps.fp == NULL) return false;
+
+    vector<char>buf(1<<20);
+    rewind(ps.fp_faces);
+    size_t nread;
+    while ((nread = fread(buf.data(), 1, buf.size(), ps.fp_faces)) > 0)
+        fwrite(buf.data(), 1, nread, ps.fp);
+    fclose(ps.fp_faces);
+
+    fseek(ps.fp, ps.vertexcountpos, SEEK_SET);
+    fprintf(ps.fp, "element vertex %*ld\n", PLYSTREAM_COUNTWIDTH, ps.n_vertices);
+    fseek(ps.fp, ps.facecountpos, SEEK_SET);
+    fprintf(ps.fp, "element face %*ld\n", PLYSTREAM_COUNTWIDTH, ps.n_faces);
+    bool isgood = !ferror(ps.fp);
+    if (fclose(ps.fp) != 0) isgood = false;
+    ps.fp = ps.fp_faces = NULL;
+    if (!isgood) {
+        cout << "Error writing PLY file " << ps.filename << endl;
+        return false;
+    }
+    cout<<"saving finish: "<<ps.filename<<endl;
+    return true;
+}
+
+
+
 bool readPLYFile(string filename,  vector<double>&vertices, vector<double> &vertices_normal){
     ifstream fin(filename.data());
     if(fin.fail()){
@@ -4,6 +4,7 @@
 
 #include<vector>
 #include<string>
+#include<stdio.h>
 using namespace std;
 
 bool readOffFile(string filename,vector<double>&vertices,vector<unsigned int>&faces2vertices);
@@ -17,8 +18,28 @@ bool writePLYFile(string filename, const vector<double>&vertices, const vector<u
 bool writePLYFile_VF(string filename,const vector<double>&vertices,const vector<unsigned int>&faces2vertices);
 bool writePLYFile_VN(string filename,const vector<double>&vertices, const vector<double>&vertices_normal);
 
+//vertices with normals, and a scalar "quality" per vertex if vertices_field is not empty, and faces
+bool writePLYFile_VFN(string filename,const vector<double>&vertices,const vector<unsigned int>&faces2vertices,
+                      const vector<double>&vertices_normal,const vector<double>&vertices_field);
+
 bool readPLYFile(string filename,  vector<double>&vertices, vector<double> &vertices_normal);
 
+//binary PLY written while the mesh is produced: vertices go straight to the file,
+//faces to a temporary file appended on close, and the counts are patched into the header
+struct PLYStream{
+    string filename;
+    FILE *fp = NULL, *fp_faces = NULL;
+    long vertexcountpos = 0, facecountpos = 0;
+    long n_vertices = 0, n_faces = 0;
+    bool isnormal = false, isfield = false;     //per vertex nx ny nz, and a scalar "quality"
+};
+//faces index the vertices as uint32, so a stream holds at most this many vertices
+#define PLYSTREAM_MAXVERTICES 4294967295LL
+bool openPLYStream(string filename, PLYStream &ps, bool isnormal = false, bool isfield = false);
+void writePLYStreamVertex(PLYStream &ps, const double *v, const double *vn = NULL, double field = 0);
+void writePLYStreamFace(PLYStream &ps, const unsigned int *fv);
+bool closePLYStream(PLYStream &ps);
+
 bool readObjFile(string filename, vector<double>&vertices, vector<unsigned int>&faces2vertices, vector<double> &vertices_normal);
 bool readObjFile_Line(string filename,vector<double>&vertices,vector<unsigned int>&edges2vertices);
 
@@ -0,0 +1,48 @@
+/***** BlockPolygonizer.h */
+
+/* header file for the parallel block polygonizer, blockpolygonizer.cpp */
+
+#ifndef BLOCKPOLYGONIZER_HDR
+#define BLOCKPOLYGONIZER_HDR
+
+#include "Polygonizer.h"
+#include <vector>
+
+typedef struct {                   /* field access of the block polygonizer */
+    double (*function)
+      (const R3Pt &in_pt);         /* implicit surface function, thread safe */
+    void (*function_batch)
+      (const R3Pt *in_pts, size_t m,
+       double *out);               /* batched function, thread safe, may be NULL */
+    void (*gradient)
+      (const R3Pt &in_pt,
+       R3Vec &out_vec);            /* field gradient, NULL: finite differences */
+    double (*taylor_bound)
+      (const R3Pt &in_pt,
+       const R3Vec &in_half,
+       double *out_model);         /* value, gradient, Hessian (13 doubles) at
+                                      in_pt; returns a bound on the error of
+                                      that quadratic model over the box of
+                                      half sides in_half; may be NULL */
+    bool (*domain)
+      (const R3Pt &in_pt,
+       const R3Vec &in_half);      /* false if the box of half sides in_half
+                                      at in_pt is not to be polygonized,
+                                      as POLYOPTIONS.domain; may be NULL */
+} BLOCKFUNCTIONS;
+
+
+bool polygonize_blocks (
+    const BLOCKFUNCTIONS &functions,
+    double size,
+    int bounds,
+    const R3Pt &in_ptStart,
+    const std::vector<R3Pt> &in_seeds,
+    int (*triproc)(int i1, int i2, int i3, VERTICES vertices),
+    void (*vertproc)(VERTICES vertices),
+    int mode = TET
+    );
+
+/* see blockpolygonizer.cpp for explanation of arguments */
+
+#endif
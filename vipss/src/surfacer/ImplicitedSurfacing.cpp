@@ -1,13 +1,79 @@
 #include "ImplicitedSurfacing.h"
+#include <unordered_map>
+#include <mutex>
+#include <atomic>
+#include <algorithm>
 
 
 typedef std::chrono::high_resolution_clock Clock;
 
 
 static Surfacer *p_ImplicitSurfacer;
+static PLYStream *p_PLYStream;
+
+//corner values shared by the levels of Surfacing_Progressive: every corner of a coarser
+//lattice is a corner of the finest one, and is keyed by its index there
+static double (*s_function)(const R3Pt &in_pt);
+static void (*s_function_batch)(const R3Pt *in_pts, size_t m, double *out);
+static R3Pt s_ptFine;
+static double s_dFine;
+static unordered_map<long long,double> s_cornercache;     //finished levels, read only while polygonizing
+static vector<pair<long long,double>> s_cornernew;        //values of the current level
+static mutex s_cornerlock;
+static bool s_isrecord;
+static atomic<long> s_nreused;
+
+void Surfacer::DataDomain::Build(vector<double>&Vs, double in_distance){
+    distance = in_distance;
+    cells.clear();
+    apt.clear();
+    int nv = Vs.size()/3;
+    if(nv==0)return;
+    for(int j=0;j<3;++j){
+        ptMin[j] = Vs[j];
+        for(int i=1;i<nv;++i)ptMin[j] = min(ptMin[j],Vs[i*3+j]);
+    }
+    vector<pair<long long,int>>keys(nv);
+    for(int i=0;i<nv;++i)keys[i] = make_pair(latticekey(Cell(Vs[i*3],0),Cell(Vs[i*3+1],1),Cell(Vs[i*3+2],2)),i);
+    sort(keys.begin(),keys.end());
+    apt.resize(nv);
+    for(int i=0;i<nv;++i){
+        for(int j=0;j<3;++j)apt[i][j] = Vs[keys[i].second*3+j];
+        auto it = cells.find(keys[i].first);
+        if(it==cells.end())cells[keys[i].first] = make_pair(i,i+1);
+        else it->second.second = i+1;
+    }
+}
+
+bool Surfacer::DataDomain::IsNear(const R3Pt &in_pt, const R3Vec &in_half) const{
+    int lo[3], hi[3];
+    for(int j=0;j<3;++j){
+        lo[j] = Cell(in_pt[j]-in_half[j]-distance,j);
+        hi[j] = Cell(in_pt[j]+in_half[j]+distance,j);
+    }
+    const double d2 = distance*distance;
+    for(int k=lo[2];k<=hi[2];++k)for(int j=lo[1];j<=hi[1];++j)for(int i=lo[0];i<=hi[0];++i){
+        auto it = cells.find(latticekey(i,j,k));
+        if(it==cells.end())continue;
+        for(int m=it->second.first;m<it->second.second;++m){
+            double dist2 = 0;
+            for(int a=0;a<3;++a){
+                double d = fabs(apt[m][a]-in_pt[a])-in_half[a];
+                if(d>0)dist2 += d*d;
+            }
+            if(dist2<=d2)return true;
+        }
+    }
+    return false;
+}
+
+//the domain callback of the engines, on the data domain of the current surfacer
+bool Surfacer::NearData(const R3Pt &in_pt, const R3Vec &in_half){
+    return p_ImplicitSurfacer->datadomain.IsNear(in_pt, in_half);
+}
+
 
 static int TriProc(int in_i1, int in_i2, int in_i3, VERTICES vs) {
-    const R3Pt pt = vs.ptr[in_i1].position;
 
     //    bool bOutside = false;
     //    for ( int j = 0; j < 3; j++ ) {
@@ -37,6 +103,95 @@ static void VertProc(VERTICES vs) {
 }
 
 
+//|grad f| at a vertex, from the gradient if given, else by central differences
+static double (*s_gradfunction)(const R3Pt &in_pt);
+static void (*s_gradient)(const R3Pt &in_pt, R3Vec &out_vec);
+static double s_graddelta;
+
+static double GradientNorm(const R3Pt &pt){
+    R3Vec g;
+    if(s_gradient)s_gradient(pt,g);
+    else for(int j=0;j<3;++j){
+        R3Vec d(0,0,0);
+        d[j] = s_graddelta;
+        g[j] = (s_gradfunction(pt+d)-s_gradfunction(pt-d))/(2*s_graddelta);
+    }
+    return Length(g);
+}
+
+//the polygonizers' normals point along the gradient, the triangles face the other way
+static void StreamVertProc(const VERTEX &v) {
+    const double pt[3] = {v.position[0], v.position[1], v.position[2]};
+    const double vn[3] = {-v.normal[0], -v.normal[1], -v.normal[2]};
+    writePLYStreamVertex( *p_PLYStream, pt, vn, p_PLYStream->isfield ? GradientNorm(v.position) : 0 );
+}
+
+static int StreamTriProc(long in_i1, long in_i2, long in_i3) {
+    if(max(in_i1,max(in_i2,in_i3)) >= PLYSTREAM_MAXVERTICES){
+        cerr<<"ERR: more than "<<PLYSTREAM_MAXVERTICES<<" vertices, beyond the index type of "<<p_PLYStream->filename<<endl;
+        return 0;
+    }
+    const uint fv[3] = {uint(in_i1), uint(in_i2), uint(in_i3)};
+    writePLYStreamFace( *p_PLYStream, fv );
+    return 1;
+}
+
+static bool FineCornerKey(const R3Pt &pt, long long &key){
+    long long r[3];
+    for(int j=0;j<3;++j){
+        double x = (pt[j]-s_ptFine[j])/s_dFine + 0.5;
+        r[j] = (long long)floor(x+0.5);
+        if(fabs(x-r[j])>1e-6)return false;
+    }
+    key = latticekey(r[0],r[1],r[2]);
+    return true;
+}
+
+static double CachedFunction(const R3Pt &pt){
+    long long key;
+    if(!FineCornerKey(pt,key))return s_function(pt);
+    auto it = s_cornercache.find(key);
+    if(it!=s_cornercache.end()){
+        s_nreused++;
+        return it->second;
+    }
+    double re = s_function(pt);
+    if(s_isrecord){
+        lock_guard<mutex> guard(s_cornerlock);
+        s_cornernew.push_back(make_pair(key,re));
+    }
+    return re;
+}
+
+static void CachedFunctionBatch(const R3Pt *pts, size_t m, double *out){
+    vector<R3Pt>misspts;
+    vector<size_t>missind;
+    vector<long long>misskey;
+    for(size_t i=0;i<m;++i){
+        long long key;
+        if(FineCornerKey(pts[i],key)){
+            auto it = s_cornercache.find(key);
+            if(it!=s_cornercache.end()){
+                out[i] = it->second;
+                continue;
+            }
+        }else key = -1;
+        misspts.push_back(pts[i]);
+        missind.push_back(i);
+        misskey.push_back(key);
+    }
+    s_nreused += m-misspts.size();
+    if(misspts.empty())return;
+
+    vector<double>re(misspts.size());
+    s_function_batch(misspts.data(), misspts.size(), re.data());
+    for(size_t i=0;i<re.size();++i)out[missind[i]] = re[i];
+    if(s_isrecord){
+        lock_guard<mutex> guard(s_cornerlock);
+        for(size_t i=0;i<re.size();++i)if(misskey[i]>=0)s_cornernew.push_back(make_pair(misskey[i],re[i]));
+    }
+}
+
 
 void Surfacer::CalSurfacingPara(vector<double>&Vs, int nvoxels){
 
@@ -80,70 +235,239 @@ void Surfacer::CalSurfacingPara(vector<double>&Vs, int nvoxels){
 
 
 
-int GetOffSurfacePoint(vector<double>&offPts, vector<double>&surPts, vector<uint>&surfv, vector<double>&testPts, double offthres){
+double Surfacer::Surfacing_Implicit(vector<double>&Vs,int n_voxels, bool ischeckall,
+                                    double (*function)(const R3Pt &in_pt),
+                                    void (*gradient)(const R3Pt &in_pt, R3Vec &out_vec),
+                                    void (*function_batch)(const R3Pt *in_pts, size_t m, double *out),
+                                    const vector<double> *normals,
+                                    double (*taylor_bound)(const R3Pt &in_pt, const R3Vec &in_half, double *out_model)){
 
+    ClearBuffer();
 
+    CalSurfacingPara(Vs, n_voxels);
 
+    double re_time;
+    cout<<"Implicit Surfacing: "<<endl;
 
-}
+    auto t1 = Clock::now();
 
+    Polygonize(Vs, ischeckall, function, gradient, function_batch, normals, taylor_bound);
 
+    cout<<"Implicit Surfacing Done."<<endl;
+    auto t2 = Clock::now();
+    cout << "Total Surfacing time: " <<  (re_time = std::chrono::nanoseconds(t2 - t1).count()/1e9) <<endl;
 
-double Surfacer::Surfacing_Implicit(vector<double>&Vs,int n_voxels, bool ischeckall,
-                                    double (*function)(const R3Pt &in_pt)){
+    return re_time;
 
-    p_ImplicitSurfacer = this;
-    ClearBuffer();
+}
 
-    CalSurfacingPara(Vs, n_voxels);
 
+double Surfacer::Surfacing_Progressive(vector<double>&Vs, int n_voxels, int n_levels, string fname, bool ischeckall,
+                                       double (*function)(const R3Pt &in_pt),
+                                       void (*gradient)(const R3Pt &in_pt, R3Vec &out_vec),
+                                       void (*function_batch)(const R3Pt *in_pts, size_t m, double *out),
+                                       const vector<double> *normals,
+                                       double (*taylor_bound)(const R3Pt &in_pt, const R3Vec &in_half, double *out_model)){
+
+    CalSurfacingPara(Vs, n_voxels);
+    const R3Pt stFine = st;
+    const double dFine = dSize;
+    const int boundFine = iBound;
 
-    //polygonize(function, size, bounds, st, triproc, vertproc);
-    double thresDist = 1e-3;
+    s_function = function;
+    s_function_batch = function_batch;
+    s_ptFine = stFine;
+    s_dFine = dFine;
+    s_cornercache.clear();
+    s_nreused = 0;
 
     double re_time;
-    cout<<"Implicit Surfacing: "<<endl;
+    cout<<"Implicit Surfacing (progressive): "<<endl;
 
     auto t1 = Clock::now();
 
+    for(int level=n_levels;level>=0;--level){
+        //level l: cubes 2^l times as wide, whose corners are every 2^l-th fine corner
+        const int scale = 1<<level;
+        if(boundFine/scale<1)continue;
+        dSize = dFine*scale;
+        iBound = boundFine/scale;
+        for(int j=0;j<3;++j)st[j] = stFine[j] + 0.5*(scale-1)*dFine;
+
+        ClearBuffer();
+        s_isrecord = level>0;
+        long n_reused = s_nreused;
+        Polygonize(Vs, ischeckall, CachedFunction, gradient, function_batch ? CachedFunctionBatch : NULL, normals, taylor_bound);
+        for(auto &kv:s_cornernew)s_cornercache[kv.first] = kv.second;
+        s_cornernew.clear();
+
+        auto t2 = Clock::now();
+        cout<<"level "<<n_voxels/scale<<": "<<all_fv.size()/3<<" triangles, "<<s_nreused-n_reused<<" corner values reused, at "
+            <<std::chrono::nanoseconds(t2 - t1).count()/1e9<<endl;
+        if(level>0)writePLYFile_VFN(fname+"_"+to_string(n_voxels/scale),all_v,all_fv,all_vn,all_vgradnorm);
+    }
+    unordered_map<long long,double>().swap(s_cornercache);
 
+    cout<<"Implicit Surfacing Done."<<endl;
+    auto t2 = Clock::now();
+    cout << "Total Surfacing time: " <<  (re_time = std::chrono::nanoseconds(t2 - t1).count()/1e9) <<endl;
 
+    return re_time;
 
-    if(!ischeckall){
-        polygonize(function, dSize, iBound, st, TriProc, VertProc);
-        GetCurSurface(all_v,all_fv);
-    }else{
+}
+
+
+bool Surfacer::SetDataDomain(vector<double>&Vs){
 
-        vector<double>offPts;
-        vector<double>surPts;
-        vector<uint>surfv;
-        vector<double>testPts = Vs;
+    if(data_distance<=0 || Vs.size()<3)return false;
 
+    double width = 0;
+    for(int j=0;j<3;++j){
+        double lo = DBL_MAX, hi = -DBL_MAX;
+        for(size_t i=j;i<Vs.size();i+=3){lo = min(lo,Vs[i]);hi = max(hi,Vs[i]);}
+        width = max(width,hi-lo);
+    }
+    //cells no finer than the cubes, so a cube looks at a few of them
+    datadomain.Build(Vs, max(data_distance*width, dSize));
+    cout<<"surfacing within "<<datadomain.distance<<" of the "<<Vs.size()/3<<" points, "<<datadomain.cells.size()<<" cells"<<endl;
+    //NearData reaches datadomain through it
+    p_ImplicitSurfacer = this;
+    return true;
 
-        int ncomp = 0;
-        while(true){
-            ClearSingleComponentBuffer();
-            if(polygonize(function, dSize, iBound, st, TriProc, VertProc))break;
+}
 
-            GetCurSurface(surPts,surfv);
-            InsertToCurSurface(surPts,surfv);
-            GetOffSurfacePoint(offPts,surPts,surfv,testPts,5e-2);
-            cout<<"ncomp found: "<<++ncomp<<" offpts: "<<offPts.size()/3<<endl;
-            if(offPts.size()<=10*3)break;
-            break;
 
-            for(int j=0;j<3;++j)st[j] = offPts[j];
-            testPts = offPts;
-        }
+void Surfacer::SurfaceSeeds(vector<double>&Vs, const vector<double> *normals,
+                            double (*function)(const R3Pt &in_pt),
+                            void (*function_batch)(const R3Pt *in_pts, size_t m, double *out),
+                            vector<R3Pt>&seeds){
+
+    seeds.resize(Vs.size()/3);
+    for(size_t i=0;i<seeds.size();++i)for(int j=0;j<3;++j)seeds[i][j] = Vs[i*3+j];
+    if(!normals || normals->size()!=Vs.size())return;
+
+    //the fit only passes near the points (user lambda), step along the normals onto it
+    vector<R3Vec>vecs(seeds.size());
+    for(size_t i=0;i<vecs.size();++i)for(int j=0;j<3;++j)vecs[i][j] = (*normals)[i*3+j];
+    int nmoved = surfaceseeds(function, function_batch, dSize, vecs, seeds);
+    cout<<"seeds: "<<nmoved<<" of "<<seeds.size()<<" moved onto the surface along the normals"<<endl;
+
+}
+
+
+void Surfacer::Polygonize(vector<double>&Vs, bool ischeckall,
+                          double (*function)(const R3Pt &in_pt),
+                          void (*gradient)(const R3Pt &in_pt, R3Vec &out_vec),
+                          void (*function_batch)(const R3Pt *in_pts, size_t m, double *out),
+                          const vector<double> *normals,
+                          double (*taylor_bound)(const R3Pt &in_pt, const R3Vec &in_half, double *out_model)){
+
+    p_ImplicitSurfacer = this;
 
+    POLYOPTIONS options;
+    options.gradient = gradient;
+    options.normal = NULL;
+    options.mode = ismarchingcubes ? NOTET : TET;
+    options.domain = SetDataDomain(Vs) ? NearData : NULL;
+
+    if(isadaptive){
+        //octree refined where the surface bends or the field is poorly fit, seeded from all points
+        OCTREEOPTIONS octopt;
+        octopt.function = function;
+        octopt.gradient = gradient;
+        octopt.tolerance = adaptive_tolerance;
+        octopt.cosangle = adaptive_cosangle;
+
+        vector<R3Pt>seeds;
+        SurfaceSeeds(Vs, normals, function, NULL, seeds);
+
+        polygonize_octree(octopt, dSize, iBound, st, seeds, TriProc, VertProc);
+        GetCurSurface(all_v,all_fv,all_vn);
+    }else if(function_batch){
+        //thread-safe batched field: parallel block polygonizer seeded from all points
+        BLOCKFUNCTIONS functions;
+        functions.function = function;
+        functions.function_batch = function_batch;
+        functions.gradient = gradient;
+        functions.taylor_bound = taylor_bound;
+        functions.domain = options.domain;
+
+        vector<R3Pt>seeds;
+        SurfaceSeeds(Vs, normals, function, function_batch, seeds);
+
+        polygonize_blocks(functions, dSize, iBound, st, seeds, TriProc, VertProc, options.mode);
+        GetCurSurface(all_v,all_fv,all_vn);
+    }else if(!ischeckall){
+        if(normals && normals->size()==Vs.size() && Vs.size()>=3){
+            //start from the first input point, which lies on the surface, stepping along its normal
+            R3Pt pt0(Vs[0],Vs[1],Vs[2]);
+            R3Vec nor0((*normals)[0],(*normals)[1],(*normals)[2]);
+            options.normal = &nor0;
+            polygonize(function, dSize, iBound, pt0, TriProc, VertProc, &options);
+        }else polygonize(function, dSize, iBound, st, TriProc, VertProc, &options);
+        GetCurSurface(all_v,all_fv,all_vn);
+    }else{
+        //every component through an input point, on one lattice centered at st
+        vector<R3Pt>seeds;
+        SurfaceSeeds(Vs, normals, function, NULL, seeds);
+
+        int ncomp = polygonize_seeds(function, dSize, iBound, st, seeds, TriProc, VertProc, &options);
+        cout<<"ncomp found: "<<ncomp<<endl;
+        GetCurSurface(all_v,all_fv,all_vn);
+    }
 
+    if(isgradientmagnitude){
+        s_gradfunction = function;
+        s_gradient = gradient;
+        s_graddelta = dSize*1e-2;
+        const long nv = all_v.size()/3;
+        all_vgradnorm.resize(nv);
+        //the field is thread safe if it comes with a batched version
+        #pragma omp parallel for schedule(dynamic, 64) if(function_batch!=NULL)
+        for(long i=0;i<nv;++i)all_vgradnorm[i] = GradientNorm(R3Pt(all_v[i*3],all_v[i*3+1],all_v[i*3+2]));
     }
 
+}
+
+
+double Surfacer::Surfacing_Streamed(vector<double>&Vs, int n_voxels, string fname,
+                                    double (*function)(const R3Pt &in_pt),
+                                    void (*gradient)(const R3Pt &in_pt, R3Vec &out_vec),
+                                    void (*function_batch)(const R3Pt *in_pts, size_t m, double *out),
+                                    double (*taylor_bound)(const R3Pt &in_pt, const R3Vec &in_half, double *out_model)){
+
+    ClearBuffer();
+
+    CalSurfacingPara(Vs, n_voxels);
+
+    PLYStream ps;
+    if(!openPLYStream(fname, ps, true, isgradientmagnitude))return -1;
+    p_PLYStream = &ps;
+    s_gradfunction = function;
+    s_gradient = gradient;
+    s_graddelta = dSize*1e-2;
+
+    BLOCKFUNCTIONS functions;
+    functions.function = function;
+    functions.function_batch = function_batch;
+    functions.gradient = gradient;
+    functions.taylor_bound = taylor_bound;
+    functions.domain = SetDataDomain(Vs) ? NearData : NULL;
+
+    double re_time;
+    cout<<"Implicit Surfacing (streamed): "<<endl;
+
+    auto t1 = Clock::now();
+
+    bool isgood = polygonize_slabs(functions, dSize, iBound, st, StreamVertProc, StreamTriProc, ismarchingcubes ? NOTET : TET);
+    isgood = closePLYStream(ps) && isgood;
+    p_PLYStream = NULL;
+
     cout<<"Implicit Surfacing Done."<<endl;
     auto t2 = Clock::now();
     cout << "Total Surfacing time: " <<  (re_time = std::chrono::nanoseconds(t2 - t1).count()/1e9) <<endl;
 
-    return re_time;
+    return isgood ? re_time : -1;
 
 }
 
@@ -160,6 +484,14 @@ void Surfacer::WriteSurface(vector<double> &v, vector<uint>&fv){
     fv = all_fv;
 }
 
+void Surfacer::WriteSurface(vector<double> &v, vector<uint>&fv, vector<double> &vn, vector<double> &vgradnorm){
+
+    v = all_v;
+    fv = all_fv;
+    vn = all_vn;
+    vgradnorm = all_vgradnorm;
+}
+
 void Surfacer::WriteSurface(vector<double> **v, vector<uint> **fv){
 
     *v = &all_v;
@@ -171,6 +503,8 @@ void Surfacer::ClearBuffer(){
     ClearSingleComponentBuffer();
     all_v.clear();
     all_fv.clear();
+    all_vn.clear();
+    all_vgradnorm.clear();
 }
 
 void Surfacer::ClearSingleComponentBuffer(){
@@ -179,13 +513,18 @@ void Surfacer::ClearSingleComponentBuffer(){
     s_afaceSurface.clearcompletely();
 }
 
-void Surfacer::GetCurSurface(vector<double>&v,vector<uint>&fv){
+void Surfacer::GetCurSurface(vector<double>&v,vector<uint>&fv,vector<double>&vn){
 
     int beInd = v.size()/3;
     for(int i=0;i<s_aptSurface.num();++i){
         for(int j=0;j<3;++j)v.push_back( s_aptSurface[i][j] );
     }
 
+    //the polygonizers' normals point along the gradient, the triangles face the other way
+    for(int i=0;i<s_avecSurface.num();++i){
+        for(int j=0;j<3;++j)vn.push_back( -s_avecSurface[i][j] );
+    }
+
     for(int i=0;i<s_afaceSurface.num();++i){
         for(int j=0;j<3;++j)fv.push_back( beInd + s_afaceSurface[i][2-j]);
     }
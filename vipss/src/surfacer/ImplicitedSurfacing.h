@@ -2,7 +2,11 @@
 #define IMPLICITEDSURFACING_H
 
 #include "Polygonizer.h"
+#include "BlockPolygonizer.h"
+#include "OctreePolygonizer.h"
+#include "SlabPolygonizer.h"
 #include "../readers.h"
+#include <unordered_map>
 
 
 class Surfacer{
@@ -18,22 +22,73 @@ public:
     vector<double>all_v;
     vector<uint>all_fv;
 
+    //unit normals at all_v from the polygonizer (analytic if a gradient is given), pointing
+    //to the side the triangles of all_fv face, and |grad f| there if isgradientmagnitude
+    vector<double>all_vn;
+    vector<double>all_vgradnorm;
+
     R3Pt st;
     double dSize;
     int iBound;
 
+    //adaptive octree surfacing (octreepolygonizer.cpp) instead of the uniform lattice;
+    //tolerance in cells of the lattice, cosangle bounds the normal spread in a cell
+    bool isadaptive;
+    double adaptive_tolerance;
+    double adaptive_cosangle;
+
+
+    //marching cubes by the cube table (NOTET) instead of six tetrahedra per cube (TET):
+    //about half the triangles and fewer vertices on the same lattice; not for the octree
+    bool ismarchingcubes;
+
+
+    //only the cubes within data_distance (a fraction of the width of the points' bounding
+    //box) of an input point are polygonized, found through a hash grid of the points;
+    //0: all cubes within the bounds; not for the octree
+    double data_distance;
+
+
+    //also evaluate the gradient magnitude at the vertices, one more gradient per vertex
+    bool isgradientmagnitude;
+
 
-    Surfacer(){}
+    Surfacer():isadaptive(false),adaptive_tolerance(0.1),adaptive_cosangle(0.95),ismarchingcubes(false),data_distance(0),
+        isgradientmagnitude(false){}
 
     void CalSurfacingPara(vector<double>&Vs, int nvoxels);
 
     double Surfacing_Implicit(vector<double>&Vs, int n_voxels, bool ischeckall,
-                   double (*function)(const R3Pt &in_pt));
+                   double (*function)(const R3Pt &in_pt),
+                   void (*gradient)(const R3Pt &in_pt, R3Vec &out_vec) = NULL,
+                   void (*function_batch)(const R3Pt *in_pts, size_t m, double *out) = NULL,
+                   const vector<double> *normals = NULL,
+                   double (*taylor_bound)(const R3Pt &in_pt, const R3Vec &in_half, double *out_model) = NULL);
+
+    //coarse to fine: first on lattices 2^n_levels, ..., 2 times coarser, each written to
+    //fname+"_<n_voxels>.ply", reusing their corner values on the finer ones; ends with the
+    //n_voxels mesh in all_v/all_fv, as Surfacing_Implicit
+    double Surfacing_Progressive(vector<double>&Vs, int n_voxels, int n_levels, string fname, bool ischeckall,
+                   double (*function)(const R3Pt &in_pt),
+                   void (*gradient)(const R3Pt &in_pt, R3Vec &out_vec) = NULL,
+                   void (*function_batch)(const R3Pt *in_pts, size_t m, double *out) = NULL,
+                   const vector<double> *normals = NULL,
+                   double (*taylor_bound)(const R3Pt &in_pt, const R3Vec &in_half, double *out_model) = NULL);
+
+    //slab by slab over the whole lattice (slabpolygonizer.cpp), the mesh streamed to the
+    //binary PLY fname+".ply" (with normals, and |grad f| if isgradientmagnitude) instead of
+    //kept in all_v/all_fv; returns -1 if the file fails or the mesh outgrows its uint32 indices
+    double Surfacing_Streamed(vector<double>&Vs, int n_voxels, string fname,
+                   double (*function)(const R3Pt &in_pt),
+                   void (*gradient)(const R3Pt &in_pt, R3Vec &out_vec) = NULL,
+                   void (*function_batch)(const R3Pt *in_pts, size_t m, double *out) = NULL,
+                   double (*taylor_bound)(const R3Pt &in_pt, const R3Vec &in_half, double *out_model) = NULL);
 
 
 
     void WriteSurface(string fname);
     void WriteSurface(vector<double> &v, vector<uint>&fv);
+    void WriteSurface(vector<double> &v, vector<uint>&fv, vector<double> &vn, vector<double> &vgradnorm);
     void WriteSurface(vector<double> **v, vector<uint>**fv);
 
     void ClearBuffer();
@@ -41,7 +96,41 @@ public:
     void ClearSingleComponentBuffer();
 
 private:
-    void GetCurSurface(vector<double> &v, vector<uint>&fv);
+    //the mesh of the lattice st, dSize, iBound, by the engine the arguments allow
+    void Polygonize(vector<double>&Vs, bool ischeckall,
+                    double (*function)(const R3Pt &in_pt),
+                    void (*gradient)(const R3Pt &in_pt, R3Vec &out_vec),
+                    void (*function_batch)(const R3Pt *in_pts, size_t m, double *out),
+                    const vector<double> *normals,
+                    double (*taylor_bound)(const R3Pt &in_pt, const R3Vec &in_half, double *out_model));
+
+    //the points Vs as seeds of the engines, moved onto the surface along the normals if given
+    void SurfaceSeeds(vector<double>&Vs, const vector<double> *normals,
+                      double (*function)(const R3Pt &in_pt),
+                      void (*function_batch)(const R3Pt *in_pts, size_t m, double *out),
+                      vector<R3Pt>&seeds);
+
+    //the input points hashed into cells of side distance, for data_distance
+    struct DataDomain{
+        double distance;
+        R3Pt ptMin;
+        vector<R3Pt>apt;                                //sorted by cell
+        unordered_map<long long,pair<int,int>>cells;    //cell -> range in apt
+
+        void Build(vector<double>&Vs, double in_distance);
+        int Cell(double x, int j) const { return (int)floor((x-ptMin[j])/distance); }
+        //false if every point is farther than distance from the box; thread safe
+        bool IsNear(const R3Pt &in_pt, const R3Vec &in_half) const;
+    };
+    DataDomain datadomain;
+
+    //hash the points Vs into datadomain; false if data_distance is 0
+    bool SetDataDomain(vector<double>&Vs);
+
+    //POLYOPTIONS/BLOCKFUNCTIONS domain: datadomain of the surfacer that set it last
+    static bool NearData(const R3Pt &in_pt, const R3Vec &in_half);
+
+    void GetCurSurface(vector<double> &v, vector<uint>&fv, vector<double> &vn);
     void InsertToCurSurface(vector<double>&v,vector<uint>&fv);
 
 
@@ -0,0 +1,36 @@
+/***** OctreePolygonizer.h */
+
+/* header file for the adaptive octree polygonizer, octreepolygonizer.cpp */
+
+#ifndef OCTREEPOLYGONIZER_HDR
+#define OCTREEPOLYGONIZER_HDR
+
+#include "Polygonizer.h"
+#include <vector>
+
+typedef struct {                   /* field access and refinement criteria */
+    double (*function)
+      (const R3Pt &in_pt);         /* implicit surface function */
+    void (*gradient)
+      (const R3Pt &in_pt,
+       R3Vec &out_vec);            /* field gradient, NULL: finite differences */
+    double tolerance;              /* allowed distance of a vertex to the surface,
+                                      in finest cells */
+    double cosangle;               /* a cell whose normals spread wider than
+                                      this (cosine) is refined */
+} OCTREEOPTIONS;
+
+
+bool polygonize_octree (
+    const OCTREEOPTIONS &options,
+    double size,
+    int bounds,
+    const R3Pt &in_ptStart,
+    const std::vector<R3Pt> &in_seeds,
+    int (*triproc)(int i1, int i2, int i3, VERTICES vertices),
+    void (*vertproc)(VERTICES vertices)
+    );
+
+/* see octreepolygonizer.cpp for explanation of arguments */
+
+#endif
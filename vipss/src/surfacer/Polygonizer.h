@@ -6,6 +6,7 @@
 #define IMPLICIT_HDR
 
 #include <utils/Rn_Defs.H>
+#include <vector>
 
 typedef struct {                   /* surface vertex */
     R3Pt  position;
@@ -17,6 +18,24 @@ typedef struct {                   /* list of vertices in polygonization */
     VERTEX *ptr;                   /* dynamically allocated */
 } VERTICES;
 
+#define TET     0  /* use tetrahedral decomposition */
+#define NOTET   1  /* no tetrahedral decomposition  */
+
+typedef struct {                   /* optional polygonizer settings */
+    void (*gradient)
+      (const R3Pt &in_pt,
+       R3Vec &out_vec);            /* field gradient, NULL: finite differences */
+    const R3Vec *normal;           /* normal at a start point on the surface,
+                                      NULL: random search around the start */
+    int mode;                      /* TET: six tetrahedra per cube, NOTET:
+                                      polygons of the cube table */
+    bool (*domain)
+      (const R3Pt &in_pt,
+       const R3Vec &in_half);      /* false if the box of half sides in_half
+                                      at in_pt is not to be polygonized,
+                                      NULL: all cubes within bounds */
+} POLYOPTIONS;
+
 
 
 #ifdef __cplusplus
@@ -29,7 +48,8 @@ bool polygonize (
 	int bounds,
     const R3Pt &in_ptStart,
 	int (*triproc)(int i1, int i2, int i3, VERTICES vertices),
-	void (*vertproc)(VERTICES vertices)	
+	void (*vertproc)(VERTICES vertices),
+	const POLYOPTIONS *options = NULL
 	);
 
 /* see implicit.c for explanation of arguments */
@@ -38,6 +58,77 @@ bool polygonize (
 }
 #endif
 
+/* polygonize_seeds: all components through the cubes of the seeds, on one
+ * lattice anchored at in_ptOrigin; returns # components or -1 (abort) */
+int polygonize_seeds (
+    double (*function)(const R3Pt &in_pt),
+    double size,
+    int bounds,
+    const R3Pt &in_ptOrigin,
+    const std::vector<R3Pt> &in_seeds,
+    int (*triproc)(int i1, int i2, int i3, VERTICES vertices),
+    void (*vertproc)(VERTICES vertices),
+    const POLYOPTIONS *options = NULL
+    );
+
+/* surfaceseeds: move the seeds onto the surface along their normals, as
+ * findalong does for the start of polygonize (two evaluations per seed,
+ * in one batch if function_batch is given); returns # seeds moved */
+int surfaceseeds (
+    double (*function)(const R3Pt &in_pt),
+    void (*function_batch)(const R3Pt *in_pts, size_t m, double *out),
+    double size,
+    const std::vector<R3Vec> &in_normals,
+    std::vector<R3Pt> &io_seeds
+    );
+
+/* converge: from two points of differing sign, converge to surface
+ * (v is the value at in_p1); shared with the block polygonizer */
+void converge ( const R3Pt &in_p1, const R3Pt &in_p2, double v,
+                double (*function)(const R3Pt &in_pt),
+                R3Pt &out_p);
+
+/* converge: same, with the values v1, v2 at both points known; Illinois
+ * (modified regula falsi) until the step is below CONVERGE_TOL of the edge */
+#define CONVERGE_TOL 1e-4
+void converge ( const R3Pt &in_p1, const R3Pt &in_p2, double v1, double v2,
+                double (*function)(const R3Pt &in_pt),
+                R3Pt &out_p);
+
+/* cubepolygons: the polygons of a cube whose corners n (LBN..RTF, see
+ * polygonizer.cpp) with bit n of index set are positive, for NOTET mode;
+ * as m, m edges (indices into cubeedges), ..., 0; ambiguous faces
+ * separate the positive corners, so neighboring cubes always agree */
+extern const int cubeedges[12][2];
+const int *cubepolygons (int index);
+
+/* latticekey: pack lattice location (i, j, k), |i|,|j|,|k| < 2^20, into one
+ * hash key; for the corner and cube tables of the engines, the data domain
+ * of the surfacer and the bricks of the field cache */
+inline long long latticekey (long long i, long long j, long long k) {
+    const long long off = 1<<20;
+    return ((i+off)<<42) | ((j+off)<<21) | (k+off);
+}
+
+/* tets: the six tetrahedra of a cube, as corners n (LBN..RTF) in the order
+ * of the dotet() calls of polygonize; tettris: the triangles of a
+ * tetrahedron whose corners with bit 3-m of index set are positive, as
+ * edges 1..6 = ab ac ad bc bd cd (tetedges), 0 terminated; for TET mode */
+extern const int tets[6][4];
+extern const int tettris[16][7];
+extern const int tetedges[7][2];
+
+/* latticepoint: location of lattice corner (i, j, k) of a lattice of cube
+ * size anchored at in_start, as for polygonize */
+void latticepoint (R3Pt &out_pt, int i, int j, int k, const R3Pt &in_start, double size);
+
+/* unitnormal: unit surface normal at in_point, from gradient if not NULL,
+ * else from forward differences of step delta */
+void unitnormal (const R3Pt &in_point,
+                 double (*function)(const R3Pt &in_pt),
+                 void (*gradient)(const R3Pt &in_pt, R3Vec &out_vec),
+                 double delta, R3Vec &out_vec);
+
 #endif
 
 
@@ -0,0 +1,22 @@
+/***** SlabPolygonizer.h */
+
+/* header file for the streaming slab polygonizer, slabpolygonizer.cpp */
+
+#ifndef SLABPOLYGONIZER_HDR
+#define SLABPOLYGONIZER_HDR
+
+#include "BlockPolygonizer.h"
+
+bool polygonize_slabs (
+    const BLOCKFUNCTIONS &functions,
+    double size,
+    int bounds,
+    const R3Pt &in_ptStart,
+    void (*vertstream)(const VERTEX &v),
+    int (*tristream)(long i1, long i2, long i3),
+    int mode = TET
+    );
+
+/* see slabpolygonizer.cpp for explanation of arguments */
+
+#endif
@@ -0,0 +1,557 @@
+#include "BlockPolygonizer.h"
+#include <unordered_map>
+#include <iostream>
+#include <math.h>
+
+using namespace std;
+
+/***** blockpolygonizer.cpp */
+
+/*
+ * Parallel variant of polygonize() (polygonizer.cpp).
+ *
+ * Same lattice, same six-tetrahedra decomposition (or cube table) and the
+ * same triangle orientation, but the lattice is walked in blocks of BLOCK^3
+ * cubes instead of cube by cube:
+ *   - blocks are seeded from points on the surface (e.g. the input points),
+ *     so every component that passes through a seed is found;
+ *   - all corner values of a block are evaluated in one batch; corners on a
+ *     face shared with an already finished block are copied from it;
+ *   - with a Taylor bound of the function, sub-blocks of 8^3, 4^3 and 2^3
+ *     cubes that provably have no sign change are not evaluated; their
+ *     corners get the value of the quadratic model instead, whose sign is
+ *     certain; such a corner of a cube with a sign change is evaluated
+ *     after all, as converge places the vertices from the values;
+ *   - with a domain, blocks and cubes outside it are neither evaluated nor
+ *     polygonized;
+ *   - the surface is followed across block faces whose corners change sign,
+ *     one wave of blocks at a time, each wave processed in parallel;
+ *   - vertices on edges inside a block are welded through a local hash
+ *     table; an edge that lies in a block face is only recorded while the
+ *     wave runs, and after it the edges are given owners in slot order, so
+ *     the mesh does not depend on the thread timing.
+ * The triangles are handed to triproc and the vertices to vertproc at the
+ * end, from one thread, as polygonize does.
+ */
+
+#define RES     10          /* as in polygonizer.cpp, for the normal delta */
+#define BLOCK   8           /* cubes per block side */
+#define BCORN   (BLOCK+1)   /* corners per block side */
+#define CULLMIN 16          /* unknown corners worth a Taylor bound */
+
+#define PENDING (1LL<<62)   /* vertex ref of a face edge not yet owned */
+
+#define BIT(i, bit) (((i)>>(bit))&1)
+
+static const int facedir[6][3] = {
+    {-1,0,0}, {1,0,0}, {0,-1,0}, {0,1,0}, {0,0,-1}, {0,0,1}
+};
+
+
+typedef struct {                   /* edge in a block face, owner unknown */
+    long long key;                 /* edgekey of the edge */
+    int ga[3], gb[3];              /* its lattice corners */
+    double va, vb;                 /* and their values */
+    int owner;                     /* slot of the block that places it */
+    int id;                        /* vertex id there */
+} FACEEDGE;
+
+typedef struct {                   /* one block of the lattice */
+    int I, J, K;                   /* block location: cubes I*BLOCK .. I*BLOCK+BLOCK-1 */
+    vector<double> values;         /* BCORN^3 corner values, u fastest */
+    vector<char> ismodel;          /* value from a Taylor model, right sign only */
+    vector<VERTEX> vertices;       /* vertices owned by this block */
+    vector<long long> tris;        /* 3 vertex refs (slot<<32 | local id) each */
+    vector<FACEEDGE> faceedges;    /* face edges of the wave, refs PENDING | index */
+    vector<int> next;              /* neighbor blocks the surface continues to */
+    int nevals;                    /* corner values evaluated here */
+    int nculled;                   /* corner values from a Taylor model */
+    int nbounds;                   /* Taylor bounds computed */
+} BLOCKDATA;
+
+typedef struct {                   /* parameters and storage */
+    BLOCKFUNCTIONS fn;
+    double size, delta;            /* cube size, normal delta */
+    int bounds;                    /* cube range within lattice */
+    int mode;                      /* TET or NOTET */
+    R3Pt start;                    /* lattice origin */
+    vector<BLOCKDATA> *blocks;
+    unordered_map<long long, int> *slots;   /* block key -> index in blocks */
+    int ndone;                     /* blocks below this index are finished */
+} BPROCESS;
+
+
+static inline int floordiv (int a, int b) {
+    return a >= 0 ? a/b : -((-a+b-1)/b);
+}
+
+static inline int cornerindex (int u, int v, int w) {
+    return (w*BCORN+v)*BCORN+u;
+}
+
+/* edgekey: lattice corner a, a < b, and the direction to b */
+static inline long long edgekey (const int *a, const int *b) {
+    const long long off = 1<<18;
+    long long key = a[0]+off;
+    key = (key<<19) | (a[1]+off);
+    key = (key<<19) | (a[2]+off);
+    return (key<<5) | ((b[0]-a[0]+1)*9 + (b[1]-a[1]+1)*3 + (b[2]-a[2]+1));
+}
+
+static inline bool inbounds (int i, int j, int k, int bounds) {
+    return abs(i) <= bounds && abs(j) <= bounds && abs(k) <= bounds;
+}
+
+static inline bool blockinbounds (int I, int J, int K, int bounds) {
+    int b[3] = {I, J, K};
+    for (int a = 0; a < 3; a++)
+        if (b[a]*BLOCK > bounds || b[a]*BLOCK+BLOCK-1 < -bounds) return false;
+    return true;
+}
+
+
+/* edgevertex: vertex on the edge ga-gb of values va, vb */
+
+static void edgevertex (const BPROCESS *p, const int *ga, const int *gb, double va, double vb,
+                        VERTEX &out_v) {
+    R3Pt a, c;
+    latticepoint(a, ga[0], ga[1], ga[2], p->start, p->size);
+    latticepoint(c, gb[0], gb[1], gb[2], p->start, p->size);
+    converge(a, c, va, vb, p->fn.function, out_v.position);
+    unitnormal(out_v.position, p->fn.function, p->fn.gradient, p->delta, out_v.normal);
+}
+
+
+/* blockvertex: vertex ref for the edge between local corners ca and cb;
+ * an edge in a block face gets a pending ref, resolved after the wave */
+
+static long long blockvertex (BPROCESS *p, int slot, unordered_map<long long, long long> &local,
+                              const int *ca, const int *cb) {
+    BLOCKDATA &b = (*p->blocks)[slot];
+    const int o[3] = {b.I*BLOCK, b.J*BLOCK, b.K*BLOCK};
+    int ga[3], gb[3];
+    for (int a = 0; a < 3; a++) { ga[a] = o[a]+ca[a]; gb[a] = o[a]+cb[a]; }
+    bool isswap = ga[0] > gb[0] || (ga[0] == gb[0] && (ga[1] > gb[1] || (ga[1] == gb[1] && ga[2] > gb[2])));
+    long long key = isswap ? edgekey(gb, ga) : edgekey(ga, gb);
+
+    auto it = local.find(key);
+    if (it != local.end()) return it->second;
+
+    const double va = b.values[cornerindex(ca[0], ca[1], ca[2])];
+    const double vb = b.values[cornerindex(cb[0], cb[1], cb[2])];
+
+    /* an edge inside a block face is shared with the neighbor block */
+    bool isshared = false;
+    for (int a = 0; a < 3; a++)
+        if (ca[a] == cb[a] && (ca[a] == 0 || ca[a] == BLOCK)) isshared = true;
+    if (isshared) {
+        FACEEDGE fe;
+        fe.key = key;
+        for (int a = 0; a < 3; a++) { fe.ga[a] = ga[a]; fe.gb[a] = gb[a]; }
+        fe.va = va;
+        fe.vb = vb;
+        long long ref = PENDING | (long long)b.faceedges.size();
+        b.faceedges.push_back(fe);
+        local[key] = ref;
+        return ref;
+    }
+
+    long long ref = ((long long)slot<<32) | (long long)b.vertices.size();
+    VERTEX v;
+    edgevertex(p, ga, gb, va, vb, v);
+    b.vertices.push_back(v);
+    local[key] = ref;
+    return ref;
+}
+
+
+/* cullbox: if the Taylor bound rules out a sign change in the s^3 cubes at
+ * local corner (u0, v0, w0), set its unknown corners from the model;
+ * otherwise try its eight halves, down to 2^3 cubes */
+
+static void cullbox (BPROCESS *p, BLOCKDATA &b, int u0, int v0, int w0, int s) {
+    const int o[3] = {b.I*BLOCK+u0, b.J*BLOCK+v0, b.K*BLOCK+w0};
+    int nunknown = 0;
+    for (int w = 0; w <= s; w++)
+        for (int v = 0; v <= s; v++)
+            for (int u = 0; u <= s; u++)
+                nunknown += isnan(b.values[cornerindex(u0+u, v0+v, w0+w)]);
+    if (nunknown < CULLMIN) return;
+
+    R3Pt c;
+    latticepoint(c, o[0], o[1], o[2], p->start, p->size);
+    const double half = 0.5*s*p->size;
+    for (int a = 0; a < 3; a++) c[a] += half;
+    double m[13];
+    double bound = p->fn.taylor_bound(c, R3Vec(half, half, half), m);
+    b.nbounds++;
+    double spread = bound;
+    for (int k = 0; k < 3; k++) spread += fabs(m[1+k])*half;
+    for (int k = 0; k < 9; k++) spread += 0.5*fabs(m[4+k])*half*half;
+
+    if (fabs(m[0]) > spread) {
+        for (int w = 0; w <= s; w++)
+            for (int v = 0; v <= s; v++)
+                for (int u = 0; u <= s; u++) {
+                    double &val = b.values[cornerindex(u0+u, v0+v, w0+w)];
+                    if (!isnan(val)) continue;
+                    double d[3] = {(u-0.5*s)*p->size, (v-0.5*s)*p->size, (w-0.5*s)*p->size};
+                    val = m[0];
+                    for (int k = 0; k < 3; k++) {
+                        val += m[1+k]*d[k];
+                        for (int l = 0; l < 3; l++) val += 0.5*m[4+k*3+l]*d[k]*d[l];
+                    }
+                    b.ismodel[cornerindex(u0+u, v0+v, w0+w)] = 1;
+                    b.nculled++;
+                }
+        return;
+    }
+    if (s <= 2) return;
+    for (int n = 0; n < 8; n++)
+        cullbox(p, b, u0+BIT(n,2)*s/2, v0+BIT(n,1)*s/2, w0+BIT(n,0)*s/2, s/2);
+}
+
+
+/* processblock: corner values, triangles and outgoing faces of one block */
+
+static void processblock (BPROCESS *p, int slot) {
+    BLOCKDATA &b = (*p->blocks)[slot];
+    const int o[3] = {b.I*BLOCK, b.J*BLOCK, b.K*BLOCK};
+
+    b.values.assign(BCORN*BCORN*BCORN, NAN);
+    b.ismodel.assign(BCORN*BCORN*BCORN, 0);
+
+    /* copy the shared faces of finished neighbors */
+    for (int f = 0; f < 6; f++) {
+        auto it = p->slots->find(latticekey(b.I+facedir[f][0], b.J+facedir[f][1], b.K+facedir[f][2]));
+        if (it == p->slots->end() || it->second >= p->ndone) continue;
+        const vector<double> &nv = (*p->blocks)[it->second].values;
+        const vector<char> &nm = (*p->blocks)[it->second].ismodel;
+        int axis = f/2, mine = f%2 ? BLOCK : 0, theirs = BLOCK-mine;
+        for (int y = 0; y < BCORN; y++)
+            for (int x = 0; x < BCORN; x++) {
+                int cm[3], ct[3];
+                cm[axis] = mine; ct[axis] = theirs;
+                cm[(axis+1)%3] = ct[(axis+1)%3] = x;
+                cm[(axis+2)%3] = ct[(axis+2)%3] = y;
+                b.values[cornerindex(cm[0], cm[1], cm[2])] = nv[cornerindex(ct[0], ct[1], ct[2])];
+                b.ismodel[cornerindex(cm[0], cm[1], cm[2])] = nm[cornerindex(ct[0], ct[1], ct[2])];
+            }
+    }
+
+    /* the cubes within the domain, and the corners they need */
+    vector<char> incube(BLOCK*BLOCK*BLOCK, 1), isneeded(BCORN*BCORN*BCORN, 1);
+    if (p->fn.domain) {
+        const double half = 0.5*p->size;
+        isneeded.assign(BCORN*BCORN*BCORN, 0);
+        for (int w = 0; w < BLOCK; w++)
+            for (int v = 0; v < BLOCK; v++)
+                for (int u = 0; u < BLOCK; u++) {
+                    const R3Pt c(p->start[0]+(o[0]+u)*p->size, p->start[1]+(o[1]+v)*p->size,
+                                 p->start[2]+(o[2]+w)*p->size);
+                    char &in = incube[(w*BLOCK+v)*BLOCK+u];
+                    in = p->fn.domain(c, R3Vec(half, half, half));
+                    if (in)
+                        for (int n = 0; n < 8; n++)
+                            isneeded[cornerindex(u+BIT(n,2), v+BIT(n,1), w+BIT(n,0))] = 1;
+                }
+    }
+
+    if (p->fn.taylor_bound) cullbox(p, b, 0, 0, 0, BLOCK);
+
+    /* evaluate the rest in one batch */
+    vector<R3Pt> pts;
+    vector<int> ind;
+    for (int w = 0; w < BCORN; w++)
+        for (int v = 0; v < BCORN; v++)
+            for (int u = 0; u < BCORN; u++) {
+                int c = cornerindex(u, v, w);
+                if (!isnan(b.values[c]) || !isneeded[c]) continue;
+                R3Pt pt;
+                latticepoint(pt, o[0]+u, o[1]+v, o[2]+w, p->start, p->size);
+                pts.push_back(pt);
+                ind.push_back(c);
+            }
+    vector<double> re(pts.size());
+    if (p->fn.function_batch) p->fn.function_batch(pts.data(), pts.size(), re.data());
+    else for (size_t i = 0; i < pts.size(); i++) re[i] = p->fn.function(pts[i]);
+    for (size_t i = 0; i < ind.size(); i++) b.values[ind[i]] = re[i];
+    b.nevals = pts.size();
+
+    /* the vertices are placed from the corner values (converge), so corners
+     * of cubes with a sign change get their exact value, not the model's */
+    if (p->fn.taylor_bound) {
+        pts.clear();
+        ind.clear();
+        for (int w = 0; w < BLOCK; w++)
+            for (int v = 0; v < BLOCK; v++)
+                for (int u = 0; u < BLOCK; u++) {
+                    if (!inbounds(o[0]+u, o[1]+v, o[2]+w, p->bounds) || !incube[(w*BLOCK+v)*BLOCK+u]) continue;
+                    int npos = 0;
+                    for (int n = 0; n < 8; n++)
+                        npos += b.values[cornerindex(u+BIT(n,2), v+BIT(n,1), w+BIT(n,0))] > 0.0;
+                    if (npos == 0 || npos == 8) continue;
+                    for (int n = 0; n < 8; n++) {
+                        int c = cornerindex(u+BIT(n,2), v+BIT(n,1), w+BIT(n,0));
+                        if (!b.ismodel[c]) continue;
+                        b.ismodel[c] = 0;
+                        R3Pt pt;
+                        latticepoint(pt, o[0]+u+BIT(n,2), o[1]+v+BIT(n,1), o[2]+w+BIT(n,0), p->start, p->size);
+                        pts.push_back(pt);
+                        ind.push_back(c);
+                    }
+                }
+        re.resize(pts.size());
+        if (p->fn.function_batch) p->fn.function_batch(pts.data(), pts.size(), re.data());
+        else for (size_t i = 0; i < pts.size(); i++) re[i] = p->fn.function(pts[i]);
+        for (size_t i = 0; i < ind.size(); i++) b.values[ind[i]] = re[i];
+        b.nevals += pts.size();
+        b.nculled -= pts.size();
+    }
+
+    /* polygonize the cubes */
+    unordered_map<long long, long long> local;
+    for (int w = 0; w < BLOCK; w++)
+        for (int v = 0; v < BLOCK; v++)
+            for (int u = 0; u < BLOCK; u++) {
+                if (!inbounds(o[0]+u, o[1]+v, o[2]+w, p->bounds)) continue;
+                if (!incube[(w*BLOCK+v)*BLOCK+u]) continue;
+                int corner[8][3], npos = 0;
+                bool pos[8];
+                for (int n = 0; n < 8; n++) {
+                    corner[n][0] = u+BIT(n,2);
+                    corner[n][1] = v+BIT(n,1);
+                    corner[n][2] = w+BIT(n,0);
+                    pos[n] = b.values[cornerindex(corner[n][0], corner[n][1], corner[n][2])] > 0.0;
+                    npos += pos[n];
+                }
+                if (npos == 0 || npos == 8) continue;
+
+                if (p->mode == NOTET) {
+                    int index = 0;
+                    for (int n = 0; n < 8; n++) index += pos[n] << n;
+                    for (const int *poly = cubepolygons(index); *poly; poly += 1+*poly) {
+                        long long a = -1, c = -1;
+                        for (int m = 0; m < *poly; m++) {
+                            const int *e = cubeedges[poly[1+m]];
+                            long long d = blockvertex(p, slot, local, corner[e[0]], corner[e[1]]);
+                            if (m >= 2) {
+                                b.tris.push_back(a);
+                                b.tris.push_back(c);
+                                b.tris.push_back(d);
+                            }
+                            if (m < 2) a = c;
+                            c = d;
+                        }
+                    }
+                    continue;
+                }
+
+                for (int t = 0; t < 6; t++) {
+                    const int *c = tets[t];
+                    int index = pos[c[0]]*8 + pos[c[1]]*4 + pos[c[2]]*2 + pos[c[3]];
+                    long long e[7];
+                    for (int m = 1; m <= 6; m++) {
+                        int c1 = c[tetedges[m][0]], c2 = c[tetedges[m][1]];
+                        if (pos[c1] != pos[c2]) e[m] = blockvertex(p, slot, local, corner[c1], corner[c2]);
+                    }
+                    for (const int *q = tettris[index]; *q; q += 3) {
+                        b.tris.push_back(e[q[0]]);
+                        b.tris.push_back(e[q[1]]);
+                        b.tris.push_back(e[q[2]]);
+                    }
+                }
+            }
+
+    /* continue across faces where the corners change sign (corners outside
+     * the domain are not evaluated) */
+    for (int f = 0; f < 6; f++) {
+        int axis = f/2, layer = f%2 ? BLOCK : 0, npos = 0, nneg = 0;
+        for (int y = 0; y < BCORN; y++)
+            for (int x = 0; x < BCORN; x++) {
+                int cm[3];
+                cm[axis] = layer;
+                cm[(axis+1)%3] = x;
+                cm[(axis+2)%3] = y;
+                const double val = b.values[cornerindex(cm[0], cm[1], cm[2])];
+                npos += val > 0.0;
+                nneg += val <= 0.0;
+            }
+        if (npos == 0 || nneg == 0) continue;
+        int I = b.I+facedir[f][0], J = b.J+facedir[f][1], K = b.K+facedir[f][2];
+        if (!blockinbounds(I, J, K, p->bounds)) continue;
+        b.next.push_back(I);
+        b.next.push_back(J);
+        b.next.push_back(K);
+    }
+}
+
+
+/* polygonize_blocks: polygonize the implicit surface function
+ *   arguments are:
+ *       const BLOCKFUNCTIONS &functions
+ *           function: the implicit surface function, negative inside
+ *           function_batch: optional, the function at m points at once
+ *           gradient: optional, used for the vertex normals
+ *           taylor_bound: optional, skips sub-blocks without the surface
+ *           domain: optional, the blocks and cubes to polygonize
+ *           all of them are called from several threads
+ *       double size, int bounds
+ *           cube width and max. range of cubes, as for polygonize
+ *       const R3Pt &in_ptStart
+ *           lattice origin; cube (0, 0, 0) is centered on it
+ *       const std::vector<R3Pt> &in_seeds
+ *           points on or near the surface; the blocks containing them
+ *           start the walk
+ *       triproc, vertproc
+ *           as for polygonize
+ *       int mode
+ *           TET or NOTET, as POLYOPTIONS.mode of polygonize
+ *   returns false if no seed lies inside the bounds or triproc aborts
+ */
+
+bool polygonize_blocks (
+    const BLOCKFUNCTIONS &functions,
+    double size,
+    int bounds,
+    const R3Pt &in_ptStart,
+    const std::vector<R3Pt> &in_seeds,
+    int (*triproc)(int i1, int i2, int i3, VERTICES vertices),
+    void (*vertproc)(VERTICES vertices),
+    int mode)
+{
+    vector<BLOCKDATA> blocks;
+    unordered_map<long long, int> slots;
+    unordered_map<long long, long long> shared;   /* face edge key -> vertex ref */
+    vector<int> frontier;
+
+    BPROCESS p;
+    p.fn = functions;
+    p.size = size;
+    p.delta = size/(double)(RES*RES);
+    p.bounds = bounds;
+    p.mode = mode;
+    p.start = in_ptStart;
+    p.blocks = &blocks;
+    p.slots = &slots;
+
+    auto addblock = [&](int I, int J, int K) {
+        long long key = latticekey(I, J, K);
+        if (slots.find(key) != slots.end()) return;
+        if (functions.domain) {
+            R3Pt c;
+            latticepoint(c, I*BLOCK, J*BLOCK, K*BLOCK, p.start, p.size);
+            const double half = 0.5*BLOCK*size;
+            for (int a = 0; a < 3; a++) c[a] += half;
+            if (!functions.domain(c, R3Vec(half, half, half))) return;
+        }
+        slots[key] = blocks.size();
+        frontier.push_back(blocks.size());
+        blocks.push_back(BLOCKDATA());
+        blocks.back().I = I;
+        blocks.back().J = J;
+        blocks.back().K = K;
+        blocks.back().nevals = 0;
+        blocks.back().nculled = 0;
+        blocks.back().nbounds = 0;
+    };
+
+    for (size_t s = 0; s < in_seeds.size(); s++) {
+        int c[3];
+        for (int a = 0; a < 3; a++) c[a] = (int)floor((in_seeds[s][a]-in_ptStart[a])/size + 0.5);
+        if (!inbounds(c[0], c[1], c[2], bounds)) continue;
+        addblock(floordiv(c[0], BLOCK), floordiv(c[1], BLOCK), floordiv(c[2], BLOCK));
+    }
+    if (frontier.empty()) {
+        cerr << "ERR: block polygonizer has no seed inside the bounds\n";
+        return false;
+    }
+
+    /* one wave of blocks at a time; a wave only reads finished blocks */
+    while (!frontier.empty()) {
+        vector<int> wave;
+        wave.swap(frontier);
+        p.ndone = wave[0];
+        const long nwave = wave.size();
+        #pragma omp parallel for schedule(dynamic)
+        for (long w = 0; w < nwave; w++) processblock(&p, wave[w]);
+
+        /* face edges: the first block in slot order that meets an edge
+         * owns its vertex, unless an earlier wave placed it already */
+        vector<FACEEDGE*> placed;
+        for (int s: wave)
+            for (FACEEDGE &fe: blocks[s].faceedges) {
+                auto it = shared.find(fe.key);
+                if (it != shared.end()) {
+                    fe.owner = it->second>>32;
+                    fe.id = it->second & 0xffffffffLL;
+                    continue;
+                }
+                fe.owner = s;
+                fe.id = blocks[s].vertices.size();
+                blocks[s].vertices.push_back(VERTEX());
+                shared[fe.key] = ((long long)s<<32) | (long long)fe.id;
+                placed.push_back(&fe);
+            }
+        const long nplaced = placed.size();
+        #pragma omp parallel for schedule(dynamic, 64)
+        for (long i = 0; i < nplaced; i++) {
+            const FACEEDGE &fe = *placed[i];
+            edgevertex(&p, fe.ga, fe.gb, fe.va, fe.vb, blocks[fe.owner].vertices[fe.id]);
+        }
+        for (int s: wave) {
+            for (long long &ref: blocks[s].tris)
+                if (ref & PENDING) {
+                    const FACEEDGE &fe = blocks[s].faceedges[ref & 0xffffffffLL];
+                    ref = ((long long)fe.owner<<32) | (long long)fe.id;
+                }
+            vector<FACEEDGE>().swap(blocks[s].faceedges);
+        }
+
+        for (int s: wave) {
+            vector<int> next;
+            next.swap(blocks[s].next);
+            for (size_t m = 0; m < next.size(); m += 3) addblock(next[m], next[m+1], next[m+2]);
+        }
+    }
+
+    /* merge: blocks in slot order, vertex refs to global ids */
+    vector<long long> offset(blocks.size()+1, 0);
+    long nevals = 0, nculled = 0, nbounds = 0;
+    for (size_t s = 0; s < blocks.size(); s++) {
+        offset[s+1] = offset[s] + blocks[s].vertices.size();
+        nevals += blocks[s].nevals;
+        nculled += blocks[s].nculled;
+        nbounds += blocks[s].nbounds;
+        vector<double>().swap(blocks[s].values);
+        vector<char>().swap(blocks[s].ismodel);
+    }
+    vector<VERTEX> allvertices(offset.back());
+    for (size_t s = 0; s < blocks.size(); s++)
+        for (size_t i = 0; i < blocks[s].vertices.size(); i++)
+            allvertices[offset[s]+i] = blocks[s].vertices[i];
+
+    VERTICES vertices;
+    vertices.count = vertices.max = allvertices.size();
+    vertices.ptr = allvertices.data();
+
+    cout << "block polygonizer: " << blocks.size() << " blocks, " << nevals << " corners, "
+         << vertices.count << " vertices" << endl;
+    if (functions.taylor_bound)
+        cout << "block polygonizer: " << nculled << " corners from " << nbounds << " Taylor bounds" << endl;
+
+    for (size_t s = 0; s < blocks.size(); s++) {
+        const vector<long long> &tris = blocks[s].tris;
+        for (size_t t = 0; t < tris.size(); t += 3) {
+            int id[3];
+            for (int m = 0; m < 3; m++) id[m] = offset[tris[t+m]>>32] + (tris[t+m] & 0xffffffffLL);
+            if (!triproc(id[0], id[1], id[2], vertices)) {
+                cerr << "ERR: block polygonizer aborted\n";
+                return false;
+            }
+        }
+    }
+    vertproc(vertices);
+
+    return true;
+}
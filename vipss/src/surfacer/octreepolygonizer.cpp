@@ -0,0 +1,440 @@
+#include "OctreePolygonizer.h"
+#include <unordered_map>
+#include <iostream>
+#include <math.h>
+
+using namespace std;
+
+/***** octreepolygonizer.cpp */
+
+/*
+ * Adaptive variant of polygonize() (polygonizer.cpp): dual contouring on an
+ * octree whose finest cells are the cubes of the uniform lattice.
+ *
+ *   - the octree is built top down; a cell is split while it is larger than
+ *     MAXSURFACE finest cells and the surface may pass through it (its
+ *     corners change sign or it holds a seed point), and below that while
+ *     its dual vertex is not good enough: the normals at its edge crossings
+ *     spread wider than cosangle, or the vertex (minimizer of the quadric
+ *     error of the crossing planes) lies farther than tolerance from the
+ *     surface or from those planes;
+ *   - cells with a corner sign change but several separate inside or outside
+ *     corner groups are always split, so one vertex never joins two sheets;
+ *   - every leaf the surface passes through gets one vertex; every minimal
+ *     edge (edge of the smallest of the cells around it) with a sign change
+ *     gives a quad on the vertices of the four cells around it, so cells of
+ *     different sizes meet without cracks;
+ *   - corner values are cached on the finest lattice, so neighboring cells
+ *     of any size share them.
+ * Flat regions end up in few large cells: fewer function calls and
+ * triangles than the uniform lattice at the same finest cell size.
+ */
+
+#define RES         10      /* as in polygonizer.cpp, for the normal delta */
+#define MINLEVEL    3       /* levels split regardless: 8^3 coarse cells */
+#define MAXSURFACE  16      /* largest cell side with a vertex, finest cells */
+
+#define BIT(i, bit) (((i)>>(bit))&1)
+
+typedef struct {                   /* octree cell */
+    int x, y, z;                   /* low corner, in finest cells */
+    int size;                      /* side, in finest cells, power of two */
+    int child;                     /* first of 8 children, -1 for a leaf */
+    int vid;                       /* vertex id, -1 if none yet */
+} ONODE;
+
+typedef struct {                   /* parameters and storage */
+    OCTREEOPTIONS opt;
+    double size, delta;            /* finest cell size, normal delta */
+    R3Pt origin;                   /* low corner of the root cell */
+    int rootsize;                  /* root side, in finest cells */
+    vector<ONODE> nodes;           /* nodes[0] is the root */
+    unordered_map<long long, double> corners;   /* finest lattice -> value */
+    vector<VERTEX> vertices;
+    const vector<R3Pt> *seeds;
+    long nevals;                   /* corner values */
+} OPROCESS;
+
+
+static void setpoint (R3Pt &out_pt, double x, double y, double z, const OPROCESS *p) {
+    out_pt[0] = p->origin[0] + x * p->size;
+    out_pt[1] = p->origin[1] + y * p->size;
+    out_pt[2] = p->origin[2] + z * p->size;
+}
+
+/* cornervalue: function value at lattice corner (x, y, z), cached */
+
+static double cornervalue (OPROCESS *p, int x, int y, int z) {
+    long long key = latticekey(x, y, z);
+    auto it = p->corners.find(key);
+    if (it != p->corners.end()) return it->second;
+    R3Pt pt;
+    setpoint(pt, x, y, z, p);
+    p->nevals++;
+    return p->corners[key] = p->opt.function(pt);
+}
+
+/* corner n of a cell is (x+BIT(n,2), y+BIT(n,1), z+BIT(n,0)) times its size */
+
+static void cellvalues (OPROCESS *p, const ONODE &nd, double v[8]) {
+    for (int n = 0; n < 8; n++)
+        v[n] = cornervalue(p, nd.x+BIT(n,2)*nd.size, nd.y+BIT(n,1)*nd.size, nd.z+BIT(n,0)*nd.size);
+}
+
+/* fieldgradient: not normalized */
+
+static void fieldgradient (OPROCESS *p, const R3Pt &in_pt, R3Vec &out_vec) {
+    if (p->opt.gradient) {
+        p->opt.gradient(in_pt, out_vec);
+        return;
+    }
+    const double f = p->opt.function(in_pt);
+    R3Vec vec(0,0,0);
+    for (int i = 0; i < 3; i++) {
+        vec[i] = p->delta;
+        out_vec[i] = (p->opt.function( in_pt + vec ) - f)/p->delta;
+        vec[i] = 0.0;
+    }
+}
+
+/* issimple: the inside corners are connected along cube edges, and so are
+ * the outside ones */
+
+static bool issimple (const double v[8]) {
+    int root[8];
+    for (int n = 0; n < 8; n++) root[n] = n;
+    for (int n = 0; n < 8; n++)
+        for (int b = 0; b < 3; b++) {
+            int m = n | (1<<b);
+            if (m == n || (v[n] > 0.0) != (v[m] > 0.0)) continue;
+            int rn = n, rm = m;
+            while (root[rn] != rn) rn = root[rn];
+            while (root[rm] != rm) rm = root[rm];
+            root[rm] = rn;
+        }
+    int ngroup = 0;
+    for (int n = 0; n < 8; n++) ngroup += root[n] == n;
+    return ngroup <= 2;
+}
+
+/* eigen3: eigen decomposition of a symmetric 3x3 matrix by Jacobi rotations,
+ * a is destroyed, eigenvalues on its diagonal, eigenvectors in columns of q */
+
+static void eigen3 (double a[3][3], double q[3][3]) {
+    for (int i = 0; i < 3; i++) for (int j = 0; j < 3; j++) q[i][j] = i == j;
+    for (int sweep = 0; sweep < 20; sweep++) {
+        double off = fabs(a[0][1]) + fabs(a[0][2]) + fabs(a[1][2]);
+        if (off < 1e-14*(fabs(a[0][0]) + fabs(a[1][1]) + fabs(a[2][2])) || off == 0.0) return;
+        for (int i = 0; i < 2; i++)
+            for (int j = i+1; j < 3; j++) {
+                if (a[i][j] == 0.0) continue;
+                double theta = (a[j][j] - a[i][i])/(2*a[i][j]);
+                double t = (theta >= 0 ? 1 : -1)/(fabs(theta) + sqrt(theta*theta+1));
+                double c = 1/sqrt(t*t+1), s = t*c;
+                for (int k = 0; k < 3; k++) {   /* a = a J */
+                    double aki = a[k][i], akj = a[k][j];
+                    a[k][i] = c*aki - s*akj;
+                    a[k][j] = s*aki + c*akj;
+                }
+                for (int k = 0; k < 3; k++) {   /* a = J^T a */
+                    double aik = a[i][k], ajk = a[j][k];
+                    a[i][k] = c*aik - s*ajk;
+                    a[j][k] = s*aik + c*ajk;
+                }
+                for (int k = 0; k < 3; k++) {   /* q = q J */
+                    double qki = q[k][i], qkj = q[k][j];
+                    q[k][i] = c*qki - s*qkj;
+                    q[k][j] = s*qki + c*qkj;
+                }
+            }
+    }
+}
+
+/* cellvertex: dual vertex of a cell whose corners change sign: minimizer of
+ * the squared distances to the tangent planes at the edge crossings, taken
+ * relative to their mass point and clamped to the cell
+ * with istest, return false if the cell should be split instead */
+
+static bool cellvertex (OPROCESS *p, const ONODE &nd, const double v[8], VERTEX &out_v, bool istest) {
+    R3Pt pts[12], a, b;
+    R3Vec nrm[12], g;
+    int k = 0;
+    for (int n = 0; n < 8; n++)
+        for (int bit = 0; bit < 3; bit++) {
+            int m = n | (1<<bit);
+            if (m == n || (v[n] > 0.0) == (v[m] > 0.0)) continue;
+            setpoint(a, nd.x+BIT(n,2)*nd.size, nd.y+BIT(n,1)*nd.size, nd.z+BIT(n,0)*nd.size, p);
+            setpoint(b, nd.x+BIT(m,2)*nd.size, nd.y+BIT(m,1)*nd.size, nd.z+BIT(m,0)*nd.size, p);
+            converge(a, b, v[n], v[m], p->opt.function, pts[k]);
+            fieldgradient(p, pts[k], g);
+            nrm[k] = UnitSafe( g );
+            k++;
+        }
+    if (k == 0) return !istest;
+
+    if (istest)
+        for (int i = 0; i < k; i++)
+            for (int j = i+1; j < k; j++)
+                if (Dot(nrm[i], nrm[j]) < p->opt.cosangle) return false;
+
+    /* quadric error relative to the mass point c: minimize |A (x-c) - r|^2 */
+    R3Pt c(0, 0, 0);
+    for (int i = 0; i < k; i++) for (int j = 0; j < 3; j++) c[j] += pts[i][j]/k;
+    double ata[3][3] = {{0}}, atb[3] = {0}, q[3][3];
+    for (int i = 0; i < k; i++) {
+        double d = Dot(nrm[i], pts[i] - c);
+        for (int r = 0; r < 3; r++) {
+            atb[r] += nrm[i][r]*d;
+            for (int s = 0; s < 3; s++) ata[r][s] += nrm[i][r]*nrm[i][s];
+        }
+    }
+    eigen3(ata, q);
+    double emax = max(ata[0][0], max(ata[1][1], ata[2][2]));
+    R3Pt x = c;
+    for (int e = 0; e < 3; e++) {   /* pseudo inverse, small eigenvalues dropped */
+        if (ata[e][e] < 0.1*emax) continue;
+        double t = (q[0][e]*atb[0] + q[1][e]*atb[1] + q[2][e]*atb[2])/ata[e][e];
+        for (int j = 0; j < 3; j++) x[j] += t*q[j][e];
+    }
+    R3Pt lo, hi;
+    setpoint(lo, nd.x, nd.y, nd.z, p);
+    setpoint(hi, nd.x+nd.size, nd.y+nd.size, nd.z+nd.size, p);
+    for (int j = 0; j < 3; j++) x[j] = min(max(x[j], lo[j]), hi[j]);
+
+    out_v.position = x;
+    fieldgradient(p, x, g);
+    out_v.normal = UnitSafe( g );
+    if (!istest) return true;
+
+    const double tol = p->opt.tolerance * p->size;
+    double res = 0;
+    for (int i = 0; i < k; i++) {
+        double d = Dot(nrm[i], x - pts[i]);
+        res += d*d;
+    }
+    if (sqrt(res/k) > tol) return false;
+    double gl = Length(g);
+    return gl > 0.0 && fabs(p->opt.function(x)) <= tol*gl;
+}
+
+/* build: decide whether node ni is split, recursively; seedids are the
+ * seeds inside it */
+
+static void build (OPROCESS *p, int ni, int level, const vector<int> &seedids) {
+    ONODE nd = p->nodes[ni];
+    double v[8];
+    cellvalues(p, nd, v);
+    int npos = 0;
+    for (int n = 0; n < 8; n++) npos += v[n] > 0.0;
+    bool iscross = npos > 0 && npos < 8;
+    bool issplit = false;
+    VERTEX vx;
+
+    if (nd.size > 1) {
+        if (level < MINLEVEL) issplit = true;
+        else if (nd.size > MAXSURFACE || !iscross) issplit = iscross || !seedids.empty();
+        else if (!issimple(v)) issplit = true;
+        else issplit = !cellvertex(p, nd, v, vx, true);
+    }
+    else if (iscross) cellvertex(p, nd, v, vx, false);
+
+    if (!issplit) {
+        if (iscross) {
+            p->nodes[ni].vid = p->vertices.size();
+            p->vertices.push_back(vx);
+        }
+        return;
+    }
+
+    int half = nd.size/2;
+    int first = p->nodes.size();
+    p->nodes[ni].child = first;
+    for (int n = 0; n < 8; n++) {
+        ONODE c;
+        c.x = nd.x + BIT(n,2)*half;
+        c.y = nd.y + BIT(n,1)*half;
+        c.z = nd.z + BIT(n,0)*half;
+        c.size = half;
+        c.child = c.vid = -1;
+        p->nodes.push_back(c);
+    }
+    vector<int> childseeds[8];
+    for (size_t s = 0; s < seedids.size(); s++) {
+        const R3Pt &pt = (*p->seeds)[seedids[s]];
+        int n = 0;
+        for (int j = 0; j < 3; j++) {
+            double u = (pt[j]-p->origin[j])/p->size - (j == 0 ? nd.x : j == 1 ? nd.y : nd.z);
+            if (u >= half) n |= 1<<(2-j);
+        }
+        childseeds[n].push_back(seedids[s]);
+    }
+    for (int n = 0; n < 8; n++) build(p, first+n, level+1, childseeds[n]);
+}
+
+/* findleaf: leaf containing the point (x2, y2, z2)/2, in finest cells;
+ * -1 outside the root */
+
+static int findleaf (const OPROCESS *p, int x2, int y2, int z2) {
+    if (x2 <= 0 || y2 <= 0 || z2 <= 0 ||
+        x2 >= 2*p->rootsize || y2 >= 2*p->rootsize || z2 >= 2*p->rootsize) return -1;
+    int ni = 0;
+    while (p->nodes[ni].child != -1) {
+        const ONODE &nd = p->nodes[ni];
+        int half = nd.size/2;
+        int n = (x2 >= 2*(nd.x+half))<<2 | (y2 >= 2*(nd.y+half))<<1 | (z2 >= 2*(nd.z+half));
+        ni = nd.child + n;
+    }
+    return ni;
+}
+
+/* leafvertex: vertex id of a leaf; a leaf the surface enters only through
+ * smaller neighbors has none yet: its center is moved onto the surface */
+
+static int leafvertex (OPROCESS *p, int ni) {
+    if (p->nodes[ni].vid != -1) return p->nodes[ni].vid;
+    const ONODE nd = p->nodes[ni];
+    VERTEX vx;
+    R3Vec g;
+    R3Pt lo, hi;
+    setpoint(vx.position, nd.x+0.5*nd.size, nd.y+0.5*nd.size, nd.z+0.5*nd.size, p);
+    setpoint(lo, nd.x, nd.y, nd.z, p);
+    setpoint(hi, nd.x+nd.size, nd.y+nd.size, nd.z+nd.size, p);
+    for (int it = 0; it < 3; it++) {
+        double f = p->opt.function(vx.position);
+        fieldgradient(p, vx.position, g);
+        double gl2 = Dot(g, g);
+        if (gl2 == 0.0) break;
+        vx.position = vx.position - g*(f/gl2);
+        for (int j = 0; j < 3; j++) vx.position[j] = min(max(vx.position[j], lo[j]), hi[j]);
+    }
+    fieldgradient(p, vx.position, g);
+    vx.normal = UnitSafe( g );
+    p->nodes[ni].vid = p->vertices.size();
+    p->vertices.push_back(vx);
+    return p->nodes[ni].vid;
+}
+
+
+/* polygonize_octree: polygonize the implicit surface function adaptively
+ *   arguments are:
+ *       const OCTREEOPTIONS &options
+ *           function: the implicit surface function, negative inside
+ *           gradient: optional, for the edge crossing planes and normals
+ *           tolerance: allowed distance of a vertex to the surface and to
+ *               the crossing planes of its cell, in finest cells (e.g. 0.1)
+ *           cosangle: cosine of the allowed spread of the normals in a cell
+ *               (e.g. 0.95)
+ *       double size, int bounds
+ *           finest cube width and max. range of cubes, as for polygonize;
+ *           the finest cells coincide with the cubes of polygonize
+ *       const R3Pt &in_ptStart
+ *           lattice origin; cube (0, 0, 0) is centered on it
+ *       const std::vector<R3Pt> &in_seeds
+ *           points on or near the surface; cells holding one are refined
+ *           until the surface is found in them
+ *       triproc, vertproc
+ *           as for polygonize
+ *   returns false if triproc aborts
+ */
+
+bool polygonize_octree (
+    const OCTREEOPTIONS &options,
+    double size,
+    int bounds,
+    const R3Pt &in_ptStart,
+    const std::vector<R3Pt> &in_seeds,
+    int (*triproc)(int i1, int i2, int i3, VERTICES vertices),
+    void (*vertproc)(VERTICES vertices))
+{
+    OPROCESS p;
+    p.opt = options;
+    p.size = size;
+    p.delta = size/(double)(RES*RES);
+    p.seeds = &in_seeds;
+    p.nevals = 0;
+    p.rootsize = 1;
+    while (p.rootsize < 2*bounds+1) p.rootsize *= 2;
+    for (int j = 0; j < 3; j++) p.origin[j] = in_ptStart[j] - (p.rootsize/2 + 0.5)*size;
+
+    ONODE root;
+    root.x = root.y = root.z = 0;
+    root.size = p.rootsize;
+    root.child = root.vid = -1;
+    p.nodes.push_back(root);
+
+    vector<int> seedids;
+    for (size_t s = 0; s < in_seeds.size(); s++) {
+        bool isin = true;
+        for (int j = 0; j < 3; j++) {
+            double u = (in_seeds[s][j]-p.origin[j])/size;
+            if (u < 0 || u >= p.rootsize) isin = false;
+        }
+        if (isin) seedids.push_back(s);
+    }
+    build(&p, 0, 0, seedids);
+
+    /* a quad around every minimal edge with a sign change, visited from
+     * the first smallest cell around it */
+    vector<int> tris;
+    static const int quad[4][2] = {{-1,-1}, {1,-1}, {1,1}, {-1,1}};
+    int nleaves = 0;
+    for (size_t ni = 0; ni < p.nodes.size(); ni++) {
+        if (p.nodes[ni].child != -1) continue;
+        nleaves++;
+        const ONODE nd = p.nodes[ni];
+        double v[8];
+        cellvalues(&p, nd, v);
+        for (int n = 0; n < 8; n++)
+            for (int bit = 0; bit < 3; bit++) {
+                int m = n | (1<<bit);
+                if (m == n || (v[n] > 0.0) == (v[m] > 0.0)) continue;
+                int a = 2-bit, a1 = (a+1)%3, a2 = (a+2)%3;
+                int mid[3] = {2*(nd.x+BIT(n,2)*nd.size), 2*(nd.y+BIT(n,1)*nd.size), 2*(nd.z+BIT(n,0)*nd.size)};
+                mid[a] += nd.size;
+                int leaf[4], id[4];
+                bool isok = true, isfirst = true;
+                for (int qd = 0; qd < 4 && isok; qd++) {
+                    int pt[3] = {mid[0], mid[1], mid[2]};
+                    pt[a1] += quad[qd][0];
+                    pt[a2] += quad[qd][1];
+                    leaf[qd] = findleaf(&p, pt[0], pt[1], pt[2]);
+                    if (leaf[qd] == -1 || p.nodes[leaf[qd]].size < nd.size) isok = false;
+                    else if (p.nodes[leaf[qd]].size == nd.size && isfirst) {
+                        isfirst = false;
+                        if (leaf[qd] != (int)ni) isok = false;
+                    }
+                }
+                if (!isok) continue;
+                for (int qd = 0; qd < 4; qd++) id[qd] = leafvertex(&p, leaf[qd]);
+
+                /* oriented as the tetrahedral polygonizer; a larger cell on
+                 * two sides of the edge leaves a triangle */
+                if (v[n] <= 0.0) swap(id[1], id[3]);
+                int poly[4], np = 0;
+                for (int qd = 0; qd < 4; qd++)
+                    if (id[qd] != id[(qd+3)%4]) poly[np++] = id[qd];
+                if (np < 3) continue;
+                for (int t = 1; t+1 < np; t++) {
+                    tris.push_back(poly[0]);
+                    tris.push_back(poly[t]);
+                    tris.push_back(poly[t+1]);
+                }
+            }
+    }
+
+    VERTICES vertices;
+    vertices.count = vertices.max = p.vertices.size();
+    vertices.ptr = p.vertices.data();
+
+    cout << "octree polygonizer: " << nleaves << " leaves, " << p.nevals << " corners, "
+         << vertices.count << " vertices" << endl;
+
+    for (size_t t = 0; t < tris.size(); t += 3)
+        if (!triproc(tris[t], tris[t+1], tris[t+2], vertices)) {
+            cerr << "ERR: octree polygonizer aborted\n";
+            return false;
+        }
+    vertproc(vertices);
+
+    return true;
+}
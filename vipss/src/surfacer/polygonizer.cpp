@@ -63,11 +63,7 @@
  * (start.x+(i-.5)*size, start.y+(j-.5)*size, start.z+(k-.5)*size) */
 
 #define RAND()    ((rand()&32767)/32767.)  /* random number, 0--1 */
-#define HASHBIT   (5)
-#define HSIZE     (size_t)(1<<(3*HASHBIT)) /* hash table size (32768) */
-#define MASK      ((1<<HASHBIT)-1)
-#define HASH(i,j,k) \
-((((((i)&MASK)<<HASHBIT)|((j)&MASK))<<HASHBIT)|((k)&MASK))
+#define EMPTYKEY  (-1LL)                   /* unused hash table slot */
 #define BIT(i, bit) (((i)>>(bit))&1)
 #define FLIP(i,bit) ((i)^1<<(bit)) /* flip the given bit of i */
 
@@ -81,15 +77,14 @@ typedef struct {                   /* test the function for a signed value */
     int ok;                        /* if value is of correct sign */
 } TEST;
 
-typedef struct cornerlist {        /* list of corners */
+typedef struct {                   /* corner of a cube */
     int i, j, k;                   /* corner id */
-    double value;                   /* corner value */
-    struct cornerlist *next;       /* remaining elements */
-} CORNERLIST;
+    double value;                  /* corner value */
+} CORNER;
 
 typedef struct {                   /* partitioning cell (cube) */
     int i, j, k;                   /* lattice location of cube */
-    CORNERLIST *corners[8];        /* eight corners */
+    CORNER corners[8];             /* eight corners */
 } CUBE;
 
 typedef struct cubes {             /* linked list (stack) of cubes */
@@ -97,16 +92,39 @@ typedef struct cubes {             /* linked list (stack) of cubes */
     struct cubes *next;            /* remaining elements */
 } CUBES;
 
-typedef struct centerlist {        /* list of cube locations */
-    int i, j, k;                   /* cube location */
-    struct centerlist *next;       /* remaining elements */
-} CENTERLIST;
+#define ARENACHUNK (64*1024)       /* bytes per arena chunk */
 
-typedef struct edgelist {          /* list of edges */
-    int i1, j1, k1, i2, j2, k2;    /* edge corner ids */
+typedef struct arenachunk {        /* chunk of arena memory */
+    struct arenachunk *next;       /* previously allocated chunks */
+} ARENACHUNK_HDR;
+
+typedef struct {                   /* bump allocator, released in one go */
+    ARENACHUNK_HDR *chunks;        /* chunk list, newest first */
+    char *cur, *end;               /* free space of the newest chunk */
+} ARENA;
+
+/* hash tables are open addressing with linear probing, keyed by packed
+ * lattice coordinates (see latticekey, edgekey), doubled when half full */
+
+typedef struct {                   /* cached corner value, 16 bytes */
+    long long key;                 /* packed corner id */
+    double value;                  /* corner value */
+} CORNERREC;
+
+typedef struct {                   /* visited cube */
+    long long key;                 /* packed cube location */
+} CENTERREC;
+
+typedef struct {                   /* vertex on a lattice edge */
+    long long key;                 /* packed edge corner ids */
     int vid;                       /* vertex id */
-    struct edgelist *next;         /* remaining elements */
-} EDGELIST;
+} EDGEREC;
+
+template <class REC> struct HASHTABLE {
+    REC *recs;                     /* 2^bits records, key EMPTYKEY if unused */
+    int bits;
+    size_t count;                  /* used records */
+};
 
 typedef struct intlist {           /* list of integers */
     int i;                         /* an integer */
@@ -123,14 +141,21 @@ typedef struct process {           /* parameters, function, storage */
       (const R3Pt &in_pt);         /* implicit surface function */
     int (*triproc)(int i1, int i2,
       int i3, VERTICES vertices);  /* triangle output function */
+    void (*gradient)(const R3Pt &in_pt,
+      R3Vec &out_vec);             /* analytic gradient or NULL */
     double size, delta;             /* cube size, normal delta */
     int bounds;                    /* cube range within lattice */
+    int mode;                      /* TET or NOTET */
+    bool (*domain)(const R3Pt &in_pt,
+      const R3Vec &in_half);       /* cubes to polygonize, or NULL */
     R3Pt start;                   /* start point on surface */
     CUBES *cubes;                  /* active cubes */
+    CUBES *freecubes;              /* popped cubes, for reuse */
+    ARENA arena;                   /* storage of the cube nodes */
     VERTICES vertices;             /* surface vertices */
-    CENTERLIST **centers;          /* cube center hash table */
-    CORNERLIST **corners;          /* corner value hash table */
-    EDGELIST **edges;              /* edge and vertex id hash table */
+    HASHTABLE<CENTERREC> centers;  /* cube center hash table */
+    HASHTABLE<CORNERREC> corners;  /* corner value hash table */
+    HASHTABLE<EDGEREC> edges;      /* edge and vertex id hash table */
 } PROCESS;
 
 
@@ -138,19 +163,114 @@ void freeprocess (PROCESS *p);
 
 int dotet (CUBE *cube, int c1, int c2, int c3, int c4, PROCESS *p);
 
-int setcenter(CENTERLIST *table[], int i, int j, int k);
+int docube (CUBE *cube, PROCESS *p);
 
-int vertid (CORNERLIST *c1, CORNERLIST *c2, PROCESS *p);
+int setcenter(HASHTABLE<CENTERREC> *table, int i, int j, int k);
+
+int vertid (const CORNER *c1, const CORNER *c2, PROCESS *p);
 
 
 char *mycalloc (int nitems, int nbytes);
-CORNERLIST *setcorner (PROCESS *p, int i, int j, int k);
+void *arenaalloc (ARENA *arena, size_t nbytes);
+void arenafree (ARENA *arena);
+CUBES *newcube (PROCESS *p);
+void initprocess (PROCESS *p, double (*function)(const R3Pt &in_pt), double size, int bounds,
+                  int (*triproc)(int i1, int i2, int i3, VERTICES vertices), const POLYOPTIONS *options);
+void pushcube (PROCESS *p, int i, int j, int k, const CORNER corners[8]);
+int marchcubes (PROCESS *p);
+CORNER setcorner (PROCESS *p, int i, int j, int k);
+
+
+/* edgekey: pack an edge between neighboring corners as its smaller corner
+ * (19 bits per axis) and the direction to the other one (5 bits) */
+
+static inline long long edgekey (int i1, int j1, int k1, int i2, int j2, int k2) {
+    const long long off = 1<<18;
+    long long key;
+    if (i1>i2 || (i1==i2 && (j1>j2 || (j1==j2 && k1>k2)))) {
+        int t=i1; i1=i2; i2=t; t=j1; j1=j2; j2=t; t=k1; k1=k2; k2=t;
+    }
+    key = i1+off;
+    key = (key<<19) | (j1+off);
+    key = (key<<19) | (k1+off);
+    return (key<<5) | ((i2-i1+1)*9 + (j2-j1+1)*3 + (k2-k1+1));
+}
+
+
+/* tableinit: empty table with room for about size records */
+
+template <class REC> void tableinit (HASHTABLE<REC> *table, size_t size) {
+    table->bits = 12;
+    while (table->bits < 48 && ((size_t)1<<table->bits) < 2*size) table->bits++;
+    table->count = 0;
+    table->recs = (REC *) malloc(((size_t)1<<table->bits)*sizeof(REC));
+    if (table->recs == NULL) {
+        fprintf(stderr, "can't malloc hash table of 2^%d records\n", table->bits);
+        exit(1);
+    }
+    for (size_t n = 0; n < ((size_t)1<<table->bits); n++) table->recs[n].key = EMPTYKEY;
+}
+
+
+/* tablefree: free the records */
+
+template <class REC> void tablefree (HASHTABLE<REC> *table) {
+    free((char *) table->recs);
+    table->recs = NULL;
+    table->count = 0;
+}
+
+
+/* tableslot: first probe position of key */
+
+template <class REC> static inline size_t tableslot (const HASHTABLE<REC> *table, long long key) {
+    return (size_t)(((unsigned long long)key * 0x9E3779B97F4A7C15ULL) >> (64-table->bits));
+}
+
+
+/* tablefind: record with the given key, NULL if not present */
+
+template <class REC> REC *tablefind (HASHTABLE<REC> *table, long long key) {
+    size_t mask = ((size_t)1<<table->bits)-1;
+    for (size_t n = tableslot(table, key);; n = (n+1)&mask) {
+        if (table->recs[n].key == key) return &table->recs[n];
+        if (table->recs[n].key == EMPTYKEY) return NULL;
+    }
+}
+
+
+/* tableinsert: record with the given key, added if not present;
+ * *isnew tells which; grows the table when it gets half full */
+
+template <class REC> REC *tableinsert (HASHTABLE<REC> *table, long long key, int *isnew) {
+    size_t mask = ((size_t)1<<table->bits)-1;
+    size_t n;
+    for (n = tableslot(table, key);; n = (n+1)&mask) {
+        if (table->recs[n].key == key) {*isnew = 0; return &table->recs[n];}
+        if (table->recs[n].key == EMPTYKEY) break;
+    }
+    *isnew = 1;
+    if (2*(table->count+1) > mask+1) {
+        HASHTABLE<REC> old = *table;
+        tableinit(table, 2*table->count+2);
+        for (size_t m = 0; m <= mask; m++)
+            if (old.recs[m].key != EMPTYKEY)
+                *tableinsert(table, old.recs[m].key, isnew) = old.recs[m];
+        tablefree(&old);
+        *isnew = 1;
+        return tableinsert(table, key, isnew);
+    }
+    table->count++;
+    table->recs[n].key = key;
+    return &table->recs[n];
+}
 
 void converge ( const R3Pt &in_p1, const R3Pt &p2, double v,
                 double (*function)(const R3Pt &in_pt),
                 R3Pt &p);
 
 TEST find (int sign, PROCESS *p, const R3Pt &in_pt);
+int findalong (PROCESS *p, const R3Pt &in_pt, const R3Vec &in_vec, TEST *in, TEST *out);
 
 
 #ifndef NOMAIN
@@ -464,6 +584,15 @@ void testface ( int i, int j, int k,
  *               in a left-handed coordinate system
  *           vertex normals point outwards
  *           return 1 to continue, 0 to abort
+ *       const POLYOPTIONS *options
+ *           optional settings, may be NULL:
+ *           gradient: analytic field gradient used for vertex normals
+ *               instead of finite differences
+ *           normal: surface normal at (x, y, z), which then must lie on
+ *               the surface; the start is found from the two points a
+ *               quarter cube off the surface along it
+ *           mode: TET (default) or NOTET
+ *           domain: the marching does not enter cubes it rejects
  *   returns error or NULL
  */
 
@@ -473,30 +602,22 @@ bool polygonize (
     int bounds,
     const R3Pt &in_pt,
     int (*triproc)(int i1, int i2, int i3, VERTICES vertices),
-	void (*vertproc)(VERTICES vertices))
+	void (*vertproc)(VERTICES vertices),
+    const POLYOPTIONS *options)
     {
     int n;
     PROCESS p;
     TEST in, out;
-    
-    p.function = function;
-    p.triproc = triproc;
-    p.size = size;
-    p.bounds = bounds;
-    p.delta = size/(double)(RES*RES);
-
-    /* allocate hash tables: */
-    p.centers = (CENTERLIST **) mycalloc(HSIZE, sizeof(CENTERLIST *));
-    p.corners = (CORNERLIST **) mycalloc(HSIZE,   sizeof(CORNERLIST *));
-    p.edges   = (EDGELIST   **) mycalloc(2*HSIZE, sizeof(EDGELIST *));
-
-    p.vertices.count = p.vertices.max = 0; /* no vertices yet */
-    p.vertices.ptr = NULL;
+    CORNER corners[8];
+
+    initprocess(&p, function, size, bounds, triproc, options);
     
     /* find point on surface, beginning search at (x, y, z):  */
-    srand(1);
-    in = find(1, &p, in_pt);
-    out = find(0, &p, in_pt);
+    if (!options || !options->normal || !findalong(&p, in_pt, *options->normal, &in, &out)) {
+        srand(1);
+        in = find(1, &p, in_pt);
+        out = find(0, &p, in_pt);
+    }
     if (!in.ok || !out.ok) {
         freeprocess(&p);
         if (!in.ok) printf ("in not ok\n");
@@ -506,46 +627,16 @@ bool polygonize (
     }
     converge(in.p, out.p, in.value, p.function, p.start);
 
-    /* push initial cube on stack: */
-    p.cubes = (CUBES *) mycalloc(1, sizeof(CUBES)); /* list of 1 */
-    p.cubes->cube.i = p.cubes->cube.j = p.cubes->cube.k = 0;
-    p.cubes->next = NULL;
-
-    /* set corners of initial cube: */
+    /* set corners of initial cube and push it on stack: */
     for (n = 0; n < 8; n++)
-        p.cubes->cube.corners[n] = \
-            setcorner(&p, BIT(n,2), BIT(n,1), BIT(n,0));
-
-    setcenter(p.centers, 0, 0, 0);
+        corners[n] = setcorner(&p, BIT(n,2), BIT(n,1), BIT(n,0));
+    setcenter(&p.centers, 0, 0, 0);
+    pushcube(&p, 0, 0, 0, corners);
 
-    while (p.cubes != NULL) { /* process active cubes till none left */
-        CUBE c;
-        CUBES *temp = p.cubes;
-        c = p.cubes->cube;
-
-        /* decompose into tetrahedra and polygonize: */
-        if (!(dotet(&c, LBN, LTN, RBN, LBF, &p) &&
-              dotet(&c, RTN, LTN, LBF, RBN, &p) &&
-              dotet(&c, RTN, LTN, LTF, LBF, &p) &&
-              dotet(&c, RTN, RBN, LBF, RBF, &p) &&
-              dotet(&c, RTN, LBF, LTF, RBF, &p) &&
-              dotet(&c, RTN, LTF, RTF, RBF, &p)))
-         {
-			 freeprocess(&p);
-			 cerr << "ERR: polyganizeraborted";
-			 return false;
-         }
-
-        /* pop current cube from stack */
-        p.cubes = p.cubes->next;
-        free((char *) temp);
-        /* test six face directions, maybe add to stack: */
-        testface(c.i-1, c.j, c.k, &c, L, LBN, LBF, LTN, LTF, &p);
-        testface(c.i+1, c.j, c.k, &c, R, RBN, RBF, RTN, RTF, &p);
-        testface(c.i, c.j-1, c.k, &c, B, LBN, LBF, RBN, RBF, &p);
-        testface(c.i, c.j+1, c.k, &c, T, LTN, LTF, RTN, RTF, &p);
-        testface(c.i, c.j, c.k-1, &c, N, LBN, LTN, RBN, RTN, &p);
-        testface(c.i, c.j, c.k+1, &c, F, LBF, LTF, RBF, RTF, &p);
+    if (!marchcubes(&p)) {
+        freeprocess(&p);
+        cerr << "ERR: polyganizeraborted";
+        return false;
     }
 
     gvertices = p.vertices;
@@ -558,32 +649,160 @@ bool polygonize (
     return NULL;
 }
 
-/* freeprocess: free all allocated memory */
 
-void freeprocess (PROCESS *p) {
-    int index;
-    CORNERLIST *l, *lnext;
-    CENTERLIST *cl, *clnext;
-    EDGELIST *edge, *edgenext;
-
-    for (index = 0; index < HSIZE; index++)
-        for (l = p->corners[index]; l; l = lnext) {
-            lnext = l->next;
-            free((char *) l);           /* free CORNERLIST */
+/* polygonize_seeds: polygonize every component of the surface that passes
+ * through the cube of one of the seeds, in one pass over the seeds
+ *   the lattice is anchored at in_ptOrigin (cube (0,0,0) is centered there)
+ *   and shared by all components, so a seed whose cube was visited while
+ *   marching an earlier component costs a single table lookup; a seed whose
+ *   cube has no sign change is skipped
+ *   all components go to one vertex array, vertproc is called once
+ *   other arguments as for polygonize; returns the number of components
+ *   started, or -1 if triproc aborted */
+
+int polygonize_seeds (
+    double (*function)(const R3Pt &in_pt),
+    double size,
+    int bounds,
+    const R3Pt &in_ptOrigin,
+    const std::vector<R3Pt> &in_seeds,
+    int (*triproc)(int i1, int i2, int i3, VERTICES vertices),
+    void (*vertproc)(VERTICES vertices),
+    const POLYOPTIONS *options)
+    {
+    int n, ncomp = 0;
+    PROCESS p;
+    CORNER corners[8];
+
+    initprocess(&p, function, size, bounds, triproc, options);
+    p.start = in_ptOrigin;
+
+    for (size_t s = 0; s < in_seeds.size(); s++) {
+        int i = (int) floor((in_seeds[s][0]-p.start[0])/size + 0.5);
+        int j = (int) floor((in_seeds[s][1]-p.start[1])/size + 0.5);
+        int k = (int) floor((in_seeds[s][2]-p.start[2])/size + 0.5);
+        int npos = 0;
+        if (abs(i) > p.bounds || abs(j) > p.bounds || abs(k) > p.bounds)
+            continue;
+        if (tablefind(&p.centers, latticekey(i, j, k))) continue;
+
+        for (n = 0; n < 8; n++) {
+            corners[n] = setcorner(&p, i+BIT(n,2), j+BIT(n,1), k+BIT(n,0));
+            npos += corners[n].value > 0.0;
         }
-    for (index = 0; index < HSIZE; index++)
-        for (cl = p->centers[index]; cl; cl = clnext) {
-            clnext = cl->next;
-            free((char *) cl);          /* free CENTERLIST */
+        if (npos == 0 || npos == 8) continue;
+
+        /* a new component: march it */
+        setcenter(&p.centers, i, j, k);
+        pushcube(&p, i, j, k, corners);
+        if (!marchcubes(&p)) {
+            freeprocess(&p);
+            cerr << "ERR: polyganizeraborted";
+            return -1;
         }
-    for (index = 0; index < 2*HSIZE; index++)
-        for (edge = p->edges[index]; edge; edge = edgenext) {
-            edgenext = edge->next;
-            free((char *) edge);        /* free EDGELIST */
+        ncomp++;
+    }
+
+    gvertices = p.vertices;
+    vertproc( gvertices );
+    freeprocess(&p);
+
+    return ncomp;
+}
+
+
+/* initprocess: set parameters and empty storage of a process */
+
+void initprocess (
+    PROCESS *p,
+    double (*function)(const R3Pt &in_pt),
+    double size,
+    int bounds,
+    int (*triproc)(int i1, int i2, int i3, VERTICES vertices),
+    const POLYOPTIONS *options)
+    {
+    p->function = function;
+    p->triproc = triproc;
+    p->gradient = options ? options->gradient : NULL;
+    p->mode = options ? options->mode : TET;
+    p->domain = options ? options->domain : NULL;
+    p->size = size;
+    p->bounds = bounds;
+    p->delta = size/(double)(RES*RES);
+
+    /* allocate hash tables, sized for a surface spanning the lattice;
+       they grow as needed, so the initial size is capped */
+    size_t tsize = 4*(size_t)bounds*bounds;
+    if (tsize > (1<<20)) tsize = 1<<20;
+    tableinit(&p->centers, tsize);
+    tableinit(&p->corners, tsize);
+    tableinit(&p->edges,   2*tsize);
+
+    p->vertices.count = p->vertices.max = 0; /* no vertices yet */
+    p->vertices.ptr = NULL;
+    p->arena.chunks = NULL;
+    p->arena.cur = p->arena.end = NULL;
+    p->cubes = p->freecubes = NULL;
+}
+
+
+/* pushcube: add cube (i, j, k) with the given corners to top of stack */
+
+void pushcube (PROCESS *p, int i, int j, int k, const CORNER corners[8]) {
+    CUBES *c = newcube(p);
+    c->cube.i = i;
+    c->cube.j = j;
+    c->cube.k = k;
+    for (int n = 0; n < 8; n++) c->cube.corners[n] = corners[n];
+    c->next = p->cubes;
+    p->cubes = c;
+}
+
+
+/* marchcubes: process active cubes till none left
+ * return 0 if client aborts, 1 otherwise */
+
+int marchcubes (PROCESS *p) {
+    while (p->cubes != NULL) {
+        CUBE c;
+        CUBES *temp = p->cubes;
+        c = p->cubes->cube;
+
+        /* polygonize the cube directly, or decompose into tetrahedra: */
+        if (p->mode == NOTET) {
+            if (!docube(&c, p)) return 0;
         }
-    free((char *) p->edges);            /* free array EDGELIST ptrs */
-    free((char *) p->corners);          /* free array CORNERLIST ptrs */
-    free((char *) p->centers);          /* free array CENTERLIST ptrs */
+        else if (!(dotet(&c, LBN, LTN, RBN, LBF, p) &&
+                   dotet(&c, RTN, LTN, LBF, RBN, p) &&
+                   dotet(&c, RTN, LTN, LTF, LBF, p) &&
+                   dotet(&c, RTN, RBN, LBF, RBF, p) &&
+                   dotet(&c, RTN, LBF, LTF, RBF, p) &&
+                   dotet(&c, RTN, LTF, RTF, RBF, p)))
+            return 0;
+
+        /* pop current cube from stack, keep its node for reuse */
+        p->cubes = p->cubes->next;
+        temp->next = p->freecubes;
+        p->freecubes = temp;
+        /* test six face directions, maybe add to stack: */
+        testface(c.i-1, c.j, c.k, &c, L, LBN, LBF, LTN, LTF, p);
+        testface(c.i+1, c.j, c.k, &c, R, RBN, RBF, RTN, RTF, p);
+        testface(c.i, c.j-1, c.k, &c, B, LBN, LBF, RBN, RBF, p);
+        testface(c.i, c.j+1, c.k, &c, T, LTN, LTF, RTN, RTF, p);
+        testface(c.i, c.j, c.k-1, &c, N, LBN, LTN, RBN, RTN, p);
+        testface(c.i, c.j, c.k+1, &c, F, LBF, LTF, RBF, RTF, p);
+    }
+    return 1;
+}
+
+/* freeprocess: free all allocated memory */
+
+void freeprocess (PROCESS *p) {
+    tablefree(&p->edges);
+    tablefree(&p->corners);
+    tablefree(&p->centers);
+    arenafree(&p->arena);               /* all cube nodes at once */
+    p->cubes = p->freecubes = NULL;
     if (p->vertices.ptr)
         free((char *) p->vertices.ptr); /* free VERTEX array */
 }
@@ -598,36 +817,39 @@ void testface (
     int face, int c1, int c2, int c3, int c4,   PROCESS *p)
     {
     CUBE cubeNew;
-    CUBES *oldcubes = p->cubes;
     static int facebit[6] = {2, 2, 1, 1, 0, 0};
-    int n, pos = old->corners[c1]->value > 0.0 ? 1 : 0;
+    int n, pos = old->corners[c1].value > 0.0 ? 1 : 0;
     int bit = facebit[face];
+    bool isset[8] = {false};
 
     /* test if  no surface crossing, cube out of bounds, or prev. visited? */
-    if ((old->corners[c2]->value > 0) == pos &&
-        (old->corners[c3]->value > 0) == pos &&
-        (old->corners[c4]->value > 0) == pos) return;
+    if ((old->corners[c2].value > 0) == pos &&
+        (old->corners[c3].value > 0) == pos &&
+        (old->corners[c4].value > 0) == pos) return;
     if (abs(i) > p->bounds || abs(j) > p->bounds || abs(k) > p->bounds)
         return;
-    if (setcenter(p->centers, i, j, k)) return;
+    if (setcenter(&p->centers, i, j, k)) return;
+    if (p->domain) {                      /* cube (i, j, k) is centered on start+(i, j, k)*size */
+        const R3Pt center(p->start[0]+i*p->size, p->start[1]+j*p->size, p->start[2]+k*p->size);
+        const double half = 0.5*p->size;
+        if (!p->domain(center, R3Vec(half, half, half))) return;
+    }
 
     /* create new cube: */
     cubeNew.i = i;
     cubeNew.j = j;
     cubeNew.k = k;
-    for (n = 0; n < 8; n++) cubeNew.corners[n] = NULL;
     cubeNew.corners[FLIP(c1, bit)] = old->corners[c1];
     cubeNew.corners[FLIP(c2, bit)] = old->corners[c2];
     cubeNew.corners[FLIP(c3, bit)] = old->corners[c3];
     cubeNew.corners[FLIP(c4, bit)] = old->corners[c4];
+    isset[FLIP(c1, bit)] = isset[FLIP(c2, bit)] = isset[FLIP(c3, bit)] = isset[FLIP(c4, bit)] = true;
     for (n = 0; n < 8; n++)
-        if (cubeNew.corners[n] == NULL) cubeNew.corners[n] =
+        if (!isset[n]) cubeNew.corners[n] =
             setcorner(p, i+BIT(n,2), j+BIT(n,1), k+BIT(n,0));
 
     /*add cube to top of stack: */
-    p->cubes = (CUBES *) mycalloc(1, sizeof(CUBES));
-    p->cubes->cube = cubeNew;
-    p->cubes->next = oldcubes;
+    pushcube(p, i, j, k, cubeNew.corners);
 }
 
 
@@ -636,31 +858,35 @@ void testface (
 void setpoint (R3Pt &out_pt, int i, int j, int k, PROCESS *p) 
 
 {
-    out_pt[0] = p->start[0]+((double)i-0.5) * p->size;
-    out_pt[1] = p->start[1]+((double)j-0.5) * p->size;
-    out_pt[2] = p->start[2]+((double)k-0.5) * p->size;
+    latticepoint(out_pt, i, j, k, p->start, p->size);
+}
+
+
+/* latticepoint: corner (i, j, k) at in_start+(i-.5)*size */
+
+void latticepoint (R3Pt &out_pt, int i, int j, int k, const R3Pt &in_start, double size) {
+    out_pt[0] = in_start[0]+((double)i-0.5) * size;
+    out_pt[1] = in_start[1]+((double)j-0.5) * size;
+    out_pt[2] = in_start[2]+((double)k-0.5) * size;
 }
 
 
 /* setcorner: return corner with the given lattice location
    set (and cache) its function value */
 
-CORNERLIST *setcorner (PROCESS *p, int i, int j, int k) {
+CORNER setcorner (PROCESS *p, int i, int j, int k) {
     /* for speed, do corner value caching here */
-    int index = HASH(i, j, k);
-    CORNERLIST *l = p->corners[index];
-    R3Pt pt;
-    
-    for (; l != NULL; l = l->next)
-        if (l->i == i && l->j == j && l->k == k) return l;
-            
-    setpoint (pt, i, j, k, p);
-    l = (CORNERLIST *) mycalloc(1, sizeof(CORNERLIST));
-    l->i = i; l->j = j; l->k = k;
-    l->value = p->function(pt);
-    l->next = p->corners[index];
-    p->corners[index] = l;
-    return l;
+    CORNER c;
+    int isnew;
+    CORNERREC *l = tableinsert(&p->corners, latticekey(i, j, k), &isnew);
+    c.i = i; c.j = j; c.k = k;
+    if (isnew) {
+        R3Pt pt;
+        setpoint (pt, i, j, k, p);
+        l->value = p->function(pt);
+    }
+    c.value = l->value;
+    return c;
 }
 
 
@@ -688,6 +914,61 @@ TEST find (int sign, PROCESS *p, const R3Pt &in_pt)
 }
 
 
+/* findalong: set in (positive) and out (non-positive) to the two points
+ * in_pt +/- size/4 in_vec, if the function differs in sign there
+ * return 1 if so, 0 otherwise */
+
+int findalong (PROCESS *p, const R3Pt &in_pt, const R3Vec &in_vec, TEST *in, TEST *out) {
+    TEST a, b;
+    const R3Vec vec = UnitSafe( in_vec ) * (0.25*p->size);
+    a.p = in_pt + vec;
+    b.p = in_pt - vec;
+    a.value = p->function(a.p);
+    b.value = p->function(b.p);
+    a.ok = b.ok = 1;
+    if ((a.value > 0.0) == (b.value > 0.0)) return 0;
+    *in  = a.value > 0.0 ? a : b;
+    *out = a.value > 0.0 ? b : a;
+    return 1;
+}
+
+
+
+/* surfaceseeds: for each seed, the two points seed +/- size/4 normal, as
+ * in findalong; if the function differs in sign there, the seed becomes
+ * the linear zero crossing between them, so it lies in a cube the surface
+ * passes through even if the fit does not interpolate the seed
+ * return # seeds moved */
+
+int surfaceseeds (
+    double (*function)(const R3Pt &in_pt),
+    void (*function_batch)(const R3Pt *in_pts, size_t m, double *out),
+    double size,
+    const std::vector<R3Vec> &in_normals,
+    std::vector<R3Pt> &io_seeds)
+    {
+    const size_t n = io_seeds.size() < in_normals.size() ? io_seeds.size() : in_normals.size();
+    std::vector<R3Pt> pts(2*n);
+    std::vector<double> vals(2*n);
+    for (size_t s = 0; s < n; s++) {
+        const R3Vec vec = UnitSafe( in_normals[s] ) * (0.25*size);
+        pts[2*s]   = io_seeds[s] + vec;
+        pts[2*s+1] = io_seeds[s] - vec;
+    }
+    if (function_batch) function_batch(pts.data(), pts.size(), vals.data());
+    else for (size_t i = 0; i < pts.size(); i++) vals[i] = function(pts[i]);
+
+    int nmoved = 0;
+    for (size_t s = 0; s < n; s++) {
+        const double va = vals[2*s], vb = vals[2*s+1];
+        if ((va > 0.0) == (vb > 0.0)) continue;
+        const double t = va/(va-vb);
+        for (int a = 0; a < 3; a++) io_seeds[s][a] = pts[2*s][a] + t*(pts[2*s+1][a]-pts[2*s][a]);
+        nmoved++;
+    }
+    return nmoved;
+}
+
 /**** Tetrahedral Polygonization ****/
 
 
@@ -696,10 +977,10 @@ TEST find (int sign, PROCESS *p, const R3Pt &in_pt)
  * return 0 if client aborts, 1 otherwise */
 
 int dotet (CUBE *cube, int c1, int c2, int c3, int c4, PROCESS *p) {
-    CORNERLIST *a = cube->corners[c1];
-    CORNERLIST *b = cube->corners[c2];
-    CORNERLIST *c = cube->corners[c3];
-    CORNERLIST *d = cube->corners[c4];
+    const CORNER *a = &cube->corners[c1];
+    const CORNER *b = &cube->corners[c2];
+    const CORNER *c = &cube->corners[c3];
+    const CORNER *d = &cube->corners[c4];
     int index = 0, apos, bpos, cpos, dpos, e1, e2, e3, e4, e5, e6;
     if (apos = (a->value > 0.0)) index += 8;
     if (bpos = (b->value > 0.0)) index += 4;
@@ -739,6 +1020,159 @@ int dotet (CUBE *cube, int c1, int c2, int c3, int c4, PROCESS *p) {
 }
 
 
+/* the six dotet() calls of polygonize as corner numbers, with the
+ * triangles of dotet() as edges, for the block and slab polygonizers */
+const int tets[6][4] = {
+    {LBN, LTN, RBN, LBF}, {RTN, LTN, LBF, RBN}, {RTN, LTN, LTF, LBF},
+    {RTN, RBN, LBF, RBF}, {RTN, LBF, LTF, RBF}, {RTN, LTF, RTF, RBF}
+};
+
+const int tettris[16][7] = {
+    {0},
+    {5,6,3, 0},
+    {2,6,4, 0},
+    {3,5,4, 3,4,2, 0},
+    {1,4,5, 0},
+    {3,1,4, 3,4,6, 0},
+    {1,2,6, 1,6,5, 0},
+    {1,2,3, 0},
+    {1,3,2, 0},
+    {1,5,6, 1,6,2, 0},
+    {1,3,6, 1,6,4, 0},
+    {1,5,4, 0},
+    {3,2,4, 3,4,5, 0},
+    {6,2,4, 0},
+    {5,3,6, 0},
+    {0}
+};
+
+const int tetedges[7][2] = {{0,0}, {0,1}, {0,2}, {0,3}, {1,2}, {1,3}, {2,3}};
+
+
+/**** Cubical Polygonization (optional) ****/
+
+
+/* the twelve cube edges, LB LT LN LF RB RT RN RF BN BF TN TF */
+const int cubeedges[12][2] = {
+    {LBN, LBF}, {LTN, LTF}, {LBN, LTN}, {LBF, LTF},
+    {RBN, RBF}, {RTN, RTF}, {RBN, RTN}, {RBF, RTF},
+    {LBN, RBN}, {LBF, RBF}, {LTN, RTN}, {LTF, RTF}
+};
+
+#define CUBEPOLYMAX 17     /* 12 edges, at most 4 polygons, terminator */
+
+typedef struct {                   /* polygons of the 256 cube cases */
+    int polys[256][CUBEPOLYMAX];
+} CUBETABLE;
+
+
+/* makecubetable: create the 256 entry table for cubical polygonization;
+ * a polygon is traced over the cube faces, clockwise around each face
+ * (seen from outside) from one sign-changing edge to the next, starting
+ * so that the corner after an edge is positive, which keeps the positive
+ * corners of an ambiguous face apart; polygons are listed from the vertex
+ * they are fanned from */
+
+static CUBETABLE makecubetable () {
+    static const int cycle[4][2] = {{0,0}, {1,0}, {1,1}, {0,1}};
+    int facecorner[6][4], faceedge[6][4];   /* faceedge m: corners m, m+1 */
+    CUBETABLE table;
+
+    for (int f = 0; f < 6; f++) {
+        int a = f/2, side = f%2;
+        for (int m = 0; m < 4; m++) {
+            /* (u, v, a) right handed: the cycle runs clockwise seen from -a */
+            const int *uv = cycle[side ? 3-m : m];
+            int x[3];
+            x[a] = side;
+            x[(a+1)%3] = uv[0];
+            x[(a+2)%3] = uv[1];
+            facecorner[f][m] = (x[0]<<2) | (x[1]<<1) | x[2];
+        }
+        for (int m = 0; m < 4; m++) {
+            int c1 = facecorner[f][m], c2 = facecorner[f][(m+1)%4];
+            for (int e = 0; e < 12; e++)
+                if ((cubeedges[e][0] == c1 && cubeedges[e][1] == c2) ||
+                    (cubeedges[e][0] == c2 && cubeedges[e][1] == c1)) faceedge[f][m] = e;
+        }
+    }
+
+    for (int i = 0; i < 256; i++) {
+        int done[12] = {0}, *out = table.polys[i];
+        for (int e = 0; e < 12; e++) {
+            if (done[e] || BIT(i, cubeedges[e][0]) == BIT(i, cubeedges[e][1])) continue;
+            int face = -1, m = 0;
+            for (int f = 0; f < 6 && face < 0; f++)
+                for (int n = 0; n < 4; n++)
+                    if (faceedge[f][n] == e && BIT(i, facecorner[f][(n+1)%4])) { face = f; m = n; }
+            int *count = out++, edge = e;
+            *count = 0;
+            do {
+                *out++ = edge;
+                (*count)++;
+                done[edge] = 1;
+                do {                       /* next sign change, clockwise */
+                    m = (m+1)%4;
+                    edge = faceedge[face][m];
+                } while (BIT(i, cubeedges[edge][0]) == BIT(i, cubeedges[edge][1]));
+                for (int f = 0; f < 6; f++) /* continue on the other face */
+                    for (int n = 0; n < 4; n++)
+                        if (f != face && faceedge[f][n] == edge) { face = f; m = n; goto found; }
+            found: ;
+            } while (edge != e);
+
+            /* fan from a vertex none of whose diagonals lies in a cube face,
+             * where it could coincide with a diagonal of the neighbor cube */
+            int *poly = count+1, k = *count;
+            for (int r = 0; r < k; r++) {
+                bool ok = true;
+                for (int j = 2; j < k-1 && ok; j++) {
+                    const int *e1 = cubeedges[poly[r]], *e2 = cubeedges[poly[(r+j)%k]];
+                    ok = (7 & ~((e1[0]^e1[1]) | (e1[0]^e2[0]) | (e1[0]^e2[1]))) == 0;
+                }
+                if (!ok) continue;
+                int rotated[12];
+                for (int j = 0; j < k; j++) rotated[j] = poly[(r+j)%k];
+                /* and reversed, to orient the triangles as dotet() does */
+                poly[0] = rotated[0];
+                for (int j = 1; j < k; j++) poly[j] = rotated[k-j];
+                break;
+            }
+        }
+        *out = 0;
+    }
+    return table;
+}
+
+
+/* cubepolygons: the polygons of cube case index, see Polygonizer.h */
+
+const int *cubepolygons (int index) {
+    static const CUBETABLE table = makecubetable();   /* built once, thread safe */
+    return table.polys[index];
+}
+
+
+/* docube: triangulate the cube directly, without decomposition
+ * return 0 if client aborts, 1 otherwise */
+
+int docube (CUBE *cube, PROCESS *p) {
+    int index = 0;
+    for (int n = 0; n < 8; n++) if (cube->corners[n].value > 0.0) index += 1<<n;
+    for (const int *poly = cubepolygons(index); *poly; poly += 1+*poly) {
+        int a = -1, b = -1;
+        for (int m = 0; m < *poly; m++) {
+            const int *e = cubeedges[poly[1+m]];
+            int c = vertid(&cube->corners[e[0]], &cube->corners[e[1]], p);
+            if (m >= 2 && !p->triproc(a, b, c, p->vertices)) return 0;
+            if (m < 2) a = b;
+            b = c;
+        }
+    }
+    return 1;
+}
+
+
 /**** Storage ****/
 
 
@@ -752,57 +1186,81 @@ char *mycalloc (int nitems, int nbytes) {
 }
 
 
-/* setcenter: set (i,j,k) entry of table[]
+/* arenaalloc: return nbytes from the arena, adding a chunk if needed */
+
+void *arenaalloc (ARENA *arena, size_t nbytes) {
+    char *ptr;
+    nbytes = (nbytes+15) & ~(size_t)15;
+    if (arena->cur == NULL || (size_t)(arena->end-arena->cur) < nbytes) {
+        size_t chunk = nbytes+16 > ARENACHUNK ? nbytes+16 : ARENACHUNK;
+        ARENACHUNK_HDR *c = (ARENACHUNK_HDR *) malloc(chunk);
+        if (c == NULL) {
+            fprintf(stderr, "can't malloc %zu bytes\n", chunk);
+            exit(1);
+        }
+        c->next = arena->chunks;
+        arena->chunks = c;
+        arena->cur = (char *) c + 16;   /* header padded for alignment */
+        arena->end = (char *) c + chunk;
+    }
+    ptr = arena->cur;
+    arena->cur += nbytes;
+    return ptr;
+}
+
+
+/* arenafree: release every chunk of the arena */
+
+void arenafree (ARENA *arena) {
+    ARENACHUNK_HDR *c, *cnext;
+    for (c = arena->chunks; c; c = cnext) {
+        cnext = c->next;
+        free((char *) c);
+    }
+    arena->chunks = NULL;
+    arena->cur = arena->end = NULL;
+}
+
+
+/* newcube: return a cube node, recycled or from the arena */
+
+CUBES *newcube (PROCESS *p) {
+    CUBES *c = p->freecubes;
+    if (c != NULL) p->freecubes = c->next;
+    else c = (CUBES *) arenaalloc(&p->arena, sizeof(CUBES));
+    c->next = NULL;
+    return c;
+}
+
+
+/* setcenter: set (i,j,k) entry of table
  * return 1 if already set; otherwise, set and return 0 */
 
-int setcenter(CENTERLIST *table[], int i, int j, int k) {
-    int index = HASH(i, j, k);
-    CENTERLIST *centerListNew, *l, *q = table[index];
-    for (l = q; l != NULL; l = l->next)
-        if (l->i == i && l->j == j && l->k == k) return 1;
-    centerListNew = (CENTERLIST *) mycalloc(1, sizeof(CENTERLIST));
-    centerListNew->i = i; centerListNew->j = j; centerListNew->k = k; centerListNew->next = q;
-    table[index] = centerListNew;
-    return 0;
+int setcenter(HASHTABLE<CENTERREC> *table, int i, int j, int k) {
+    int isnew;
+    tableinsert(table, latticekey(i, j, k), &isnew);
+    return !isnew;
 }
 
 
 /* setedge: set vertex id for edge */
 
 void setedge (
-    EDGELIST *table[],
+    HASHTABLE<EDGEREC> *table,
     int i1, int j1, int k1, int i2, int j2, int k2, int vid)
     {
-    unsigned int index;
-    EDGELIST *edgeListNew;
-    if (i1>i2 || (i1==i2 && (j1>j2 || (j1==j2 && k1>k2)))) {
-        int t=i1; i1=i2; i2=t; t=j1; j1=j2; j2=t; t=k1; k1=k2; k2=t;
-    }
-    index = HASH(i1, j1, k1) + HASH(i2, j2, k2);
-    edgeListNew = (EDGELIST *) mycalloc(1, sizeof(EDGELIST));
-    edgeListNew->i1 = i1; edgeListNew->j1 = j1; edgeListNew->k1 = k1;
-    edgeListNew->i2 = i2; edgeListNew->j2 = j2; edgeListNew->k2 = k2;
-    edgeListNew->vid = vid;
-    edgeListNew->next = table[index];
-    table[index] = edgeListNew;
+    int isnew;
+    tableinsert(table, edgekey(i1, j1, k1, i2, j2, k2), &isnew)->vid = vid;
 }
 
 
 /* getedge: return vertex id for edge; return -1 if not set */
 
-int getedge (EDGELIST *table[],
+int getedge (HASHTABLE<EDGEREC> *table,
              int i1, int j1, int k1, int i2, int j2, int k2)
     {
-    EDGELIST *q;
-    if (i1>i2 || (i1==i2 && (j1>j2 || (j1==j2 && k1>k2)))) {
-        int t=i1; i1=i2; i2=t; t=j1; j1=j2; j2=t; t=k1; k1=k2; k2=t;
-    }
-    q = table[HASH(i1, j1, k1)+HASH(i2, j2, k2)];
-    for (; q != NULL; q = q->next)
-        if (q->i1 == i1 && q->j1 == j1 && q->k1 == k1 &&
-            q->i2 == i2 && q->j2 == j2 && q->k2 == k2)
-            return q->vid;
-    return -1;
+    EDGEREC *q = tablefind(table, edgekey(i1, j1, k1, i2, j2, k2));
+    return q ? q->vid : -1;
 }
 
 
@@ -817,18 +1275,18 @@ void vnormal (const R3Pt &in_point, PROCESS *p, R3Vec &out_v);
  * c1->value and c2->value are presumed of different sign
  * return saved index if any; else compute vertex and save */
 
-int vertid (CORNERLIST *c1, CORNERLIST *c2, PROCESS *p) {
+int vertid (const CORNER *c1, const CORNER *c2, PROCESS *p) {
     VERTEX v;
     R3Pt a, b;
     int vid =
-        getedge(p->edges, c1->i, c1->j, c1->k, c2->i, c2->j, c2->k);
+        getedge(&p->edges, c1->i, c1->j, c1->k, c2->i, c2->j, c2->k);
     if (vid != -1) return vid;                /* previously computed */
     setpoint (a, c1->i, c1->j, c1->k, p);
     setpoint (b, c2->i, c2->j, c2->k, p);
-    converge (a, b, c1->value, p->function, v.position); /* posn.  */
+    converge (a, b, c1->value, c2->value, p->function, v.position); /* posn.  */
     vnormal(v.position, p, v.normal);                     /* normal */
     vid = addtovertices(&p->vertices, v);                   /* save   */
-    setedge(p->edges, c1->i, c1->j, c1->k, c2->i, c2->j, c2->k, vid);
+    setedge(&p->edges, c1->i, c1->j, c1->k, c2->i, c2->j, c2->k, vid);
     return vid;
 }
 
@@ -837,12 +1295,13 @@ int vertid (CORNERLIST *c1, CORNERLIST *c2, PROCESS *p) {
 
 int addtovertices (VERTICES *vertices, VERTEX v) {
    if (vertices->count == vertices->max) {
-      int i;
       VERTEX *vertexNew;
-      vertices->max = vertices->count == 0 ? 10 : 2*vertices->count;
-      vertexNew = (VERTEX *) mycalloc((unsigned)vertices->max,sizeof(VERTEX));
-      for (i = 0; i < vertices->count; i++) vertexNew[i] = vertices->ptr[i];
-      if (vertices->ptr != NULL) free((char *) vertices->ptr);
+      vertices->max = vertices->count == 0 ? 1024 : 2*vertices->count;
+      vertexNew = (VERTEX *) realloc(vertices->ptr, (size_t)vertices->max*sizeof(VERTEX));
+      if (vertexNew == NULL) {
+          fprintf(stderr, "can't realloc %d vertices\n", vertices->max);
+          exit(1);
+      }
       vertices->ptr = vertexNew;
    }
    vertices->ptr[vertices->count++] = v;
@@ -853,26 +1312,37 @@ int addtovertices (VERTICES *vertices, VERTEX v) {
 /* vnormal: compute unit length surface normal at point */
 
 void vnormal (const R3Pt &in_point, PROCESS *p, R3Vec &out_vec) {
-    const double f = p->function(in_point);
+    unitnormal(in_point, p->function, p->gradient, p->delta, out_vec);
+}
+
+
+/* unitnormal: from the gradient, or forward differences of step delta */
 
+void unitnormal (const R3Pt &in_point,
+                 double (*function)(const R3Pt &in_pt),
+                 void (*gradient)(const R3Pt &in_pt, R3Vec &out_vec),
+                 double delta, R3Vec &out_vec) {
+    if (gradient) {
+        gradient(in_point, out_vec);
+        out_vec = UnitSafe( out_vec );
+        return;
+    }
 
+    const double f = function(in_point);
 
     R3Vec vec(0,0,0);
 
     for ( int i = 0; i < 3; i++ ) {
 
-        vec[i] = p->delta;
+        vec[i] = delta;
 
-        out_vec[i] = p->function( in_point + vec ) - f;
+        out_vec[i] = function( in_point + vec ) - f;
 
         vec[i] = 0.0;
 
     }
 
-
-
     out_vec = UnitSafe( out_vec );
-
 }
 
 
@@ -909,3 +1379,40 @@ void converge ( const R3Pt &in_p1, const R3Pt &in_p2, double v,
         else {neg = out_p;}
     }
 }
+
+
+/* converge: from two points of differing sign with known values, converge
+ * to surface by Illinois iterations on the segment parameter; the root stays
+ * bracketed and a linear field is hit by the first step, so 2--3 function
+ * evaluations usually suffice; unlike bisection this uses the magnitudes,
+ * so v1, v2 must be values of function, not estimates of the right sign */
+
+void converge ( const R3Pt &in_p1, const R3Pt &in_p2, double v1, double v2,
+                double (*function)(const R3Pt &in_pt),
+                R3Pt &out_p)
+{
+    double ta = 0.0, tb = 1.0, fa = v1, fb = v2;
+    double t = -1.0, tprev;
+    int i, side = 0;
+
+    for (i = 0; i < 2*RES; i++) {
+        tprev = t;
+        t = (ta*fb - tb*fa)/(fb - fa);
+        out_p = Lerp( in_p1, in_p2, t );
+        if (fabs(t - tprev) < CONVERGE_TOL) return;
+
+        double f = function(out_p);
+        if (f == 0.0) return;
+        if ((f > 0.0) == (fb > 0.0)) {
+            tb = t; fb = f;
+            if (side == -1) fa *= 0.5;  /* same end twice: halve the other */
+            side = -1;
+        }
+        else {
+            ta = t; fa = f;
+            if (side == 1) fb *= 0.5;
+            side = 1;
+        }
+    }
+    out_p = Lerp( in_p1, in_p2, (ta*fb - tb*fa)/(fb - fa) );
+}
@@ -0,0 +1,377 @@
+#include "SlabPolygonizer.h"
+#include <unordered_map>
+#include <iostream>
+#include <math.h>
+
+using namespace std;
+
+/***** slabpolygonizer.cpp */
+
+/*
+ * Streaming variant of polygonize() (polygonizer.cpp) for very fine lattices.
+ *
+ * Same lattice, same six-tetrahedra decomposition (or cube table) and the
+ * same triangle orientation, but instead of following the surface from a
+ * start cube, all cubes within the bounds are visited, one slab of cubes
+ * (fixed k) at a time:
+ *   - only the corner values of the two lattice planes of the current slab
+ *     are kept, and the vertex ids of the edges in and between them;
+ *   - the vertices and triangles of a slab are handed to vertstream and
+ *     tristream as soon as the slab is done; vertex ids count up from 0 in
+ *     the order of the vertstream calls, so no part of the mesh is kept;
+ *   - with a Taylor bound of the function, tiles of TILE^2 cubes of the slab,
+ *     then of MINTILE^2, that provably have no sign change are skipped
+ *     without evaluating their corners; a tile that is clear for the next
+ *     TILE slabs is skipped for all of them;
+ *   - with a domain, tiles and then cubes outside it are skipped the same way;
+ *   - corner values and vertices are computed in parallel, slab by slab.
+ * Memory thus grows with bounds^2, not with the size of the mesh.  Unlike
+ * polygonize, every component within the bounds is found.
+ */
+
+#define RES     10          /* as in polygonizer.cpp, for the normal delta */
+#define TILE    8           /* cubes per side of a culled tile */
+#define MINTILE 4           /* smallest tile worth a Taylor bound */
+#define CHUNK   4096        /* corners per batch evaluation */
+
+#define BIT(i, bit) (((i)>>(bit))&1)
+
+typedef struct {                   /* vertex still to be computed */
+    int a[3], b[3];                /* lattice corners of its edge */
+    double va, vb;                 /* and their values */
+} PENDING;
+
+typedef struct {                   /* parameters and storage */
+    BLOCKFUNCTIONS fn;
+    bool isparallel;               /* fn may be called from several threads */
+    double size, delta;            /* cube size, normal delta */
+    int bounds;                    /* cube range within lattice */
+    int mode;                      /* TET or NOTET */
+    int n;                         /* corners per side of a plane */
+    int ncube;                     /* cubes per side of a slab */
+    R3Pt start;                    /* lattice origin */
+    int k;                         /* current slab: cubes k, corners k and k+1 */
+    vector<double> lower, upper;   /* corner values of planes k and k+1,
+                                      NaN: not evaluated */
+    vector<char> active;           /* cubes of the slab that may hold surface */
+    unordered_map<long long, long>
+        loweredges, upperedges,    /* vertex ids of edges in planes k, k+1 */
+        crossedges;                /* and between them */
+    vector<PENDING> pending;       /* new vertices of the slab */
+    vector<long> tris;             /* triangles of the slab */
+    long nvertices;                /* vertices of the finished slabs */
+} SPROCESS;
+
+
+static inline int planeindex (const SPROCESS *p, int i, int j) {
+    return (j+p->bounds)*p->n + (i+p->bounds);
+}
+
+static inline int cubeindex (const SPROCESS *p, int i, int j) {
+    return (j+p->bounds)*p->ncube + (i+p->bounds);
+}
+
+
+/* isclear: true if the Taylor bound rules out a sign change in the
+ * wi x wj x wk cubes at (i0, j0, k) */
+
+static bool isclear (const SPROCESS *p, int i0, int j0, int k, int wi, int wj, int wk) {
+    R3Pt c;
+    latticepoint(c, i0, j0, k, p->start, p->size);
+    const R3Vec half(0.5*wi*p->size, 0.5*wj*p->size, 0.5*wk*p->size);
+    for (int a = 0; a < 3; a++) c[a] += half[a];
+    double m[13];
+    double spread = p->fn.taylor_bound(c, half, m);
+    for (int a = 0; a < 3; a++) {
+        spread += fabs(m[1+a])*half[a];
+        for (int b = 0; b < 3; b++) spread += 0.5*fabs(m[4+a*3+b])*half[a]*half[b];
+    }
+    return fabs(m[0]) > spread;
+}
+
+
+/* culltile: mark the cubes of the wi x wj tile at (i0, j0) of the slab
+ * active, unless the Taylor bound rules out a sign change in it; tiles
+ * larger than MINTILE are split first; returns # bounds computed */
+
+static int culltile (SPROCESS *p, int i0, int j0, int wi, int wj) {
+    if (isclear(p, i0, j0, p->k, wi, wj, 1)) return 1;
+
+    if (wi <= MINTILE && wj <= MINTILE) {
+        for (int j = j0; j < j0+wj; j++)
+            for (int i = i0; i < i0+wi; i++) p->active[cubeindex(p, i, j)] = 1;
+        return 1;
+    }
+    int ni = wi > MINTILE ? 2 : 1, nj = wj > MINTILE ? 2 : 1, nbounds = 1;
+    for (int y = 0; y < nj; y++)
+        for (int x = 0; x < ni; x++) {
+            int si = ni == 1 ? wi : x ? wi-wi/2 : wi/2;
+            int sj = nj == 1 ? wj : y ? wj-wj/2 : wj/2;
+            nbounds += culltile(p, i0+x*(wi/2), j0+y*(wj/2), si, sj);
+        }
+    return nbounds;
+}
+
+
+/* indomain: true if the wi x wj x wk cubes at (i0, j0, k) may be in the domain */
+
+static bool indomain (const SPROCESS *p, int i0, int j0, int k, int wi, int wj, int wk) {
+    R3Pt c;
+    latticepoint(c, i0, j0, k, p->start, p->size);
+    const R3Vec half(0.5*wi*p->size, 0.5*wj*p->size, 0.5*wk*p->size);
+    for (int a = 0; a < 3; a++) c[a] += half[a];
+    return p->fn.domain(c, half);
+}
+
+
+/* slabvertex: id of the vertex on the edge between lattice corners ca, cb
+ * of the slab, queued for computation if the edge is new */
+
+static long slabvertex (SPROCESS *p, const int *ca, const int *cb, double va, double vb) {
+    const int *a = ca, *b = cb;
+    if (a[2] > b[2] || (a[2] == b[2] && (a[1] > b[1] || (a[1] == b[1] && a[0] > b[0])))) {
+        a = cb;
+        b = ca;
+    }
+    unordered_map<long long, long> &edges =
+        a[2] != b[2] ? p->crossedges : a[2] == p->k ? p->loweredges : p->upperedges;
+    long long key = (long long)planeindex(p, a[0], a[1])*9 + (b[0]-a[0]+1)*3 + (b[1]-a[1]+1);
+
+    auto it = edges.find(key);
+    if (it != edges.end()) return it->second;
+
+    long id = p->nvertices + (long)p->pending.size();
+    PENDING e;
+    for (int m = 0; m < 3; m++) { e.a[m] = ca[m]; e.b[m] = cb[m]; }
+    e.va = va;
+    e.vb = vb;
+    p->pending.push_back(e);
+    edges[key] = id;
+    return id;
+}
+
+
+/* evaluateslab: the missing corner values of the active cubes */
+
+static long evaluateslab (SPROCESS *p) {
+    vector<R3Pt> pts;
+    vector<double *> dst;
+    for (int j = -p->bounds; j <= p->bounds; j++)
+        for (int i = -p->bounds; i <= p->bounds; i++) {
+            if (!p->active[cubeindex(p, i, j)]) continue;
+            for (int n = 0; n < 8; n++) {
+                int ci = i+BIT(n,2), cj = j+BIT(n,1), ck = p->k+BIT(n,0);
+                double &val = (ck == p->k ? p->lower : p->upper)[planeindex(p, ci, cj)];
+                if (!isnan(val)) continue;
+                val = HUGE_VAL;                 /* queued */
+                R3Pt pt;
+                latticepoint(pt, ci, cj, ck, p->start, p->size);
+                pts.push_back(pt);
+                dst.push_back(&val);
+            }
+        }
+
+    const long m = pts.size(), nchunks = (m+CHUNK-1)/CHUNK;
+    vector<double> re(m);
+    #pragma omp parallel for schedule(dynamic) if(p->isparallel)
+    for (long c = 0; c < nchunks; c++) {
+        const long b = c*CHUNK, e = b+CHUNK < m ? b+CHUNK : m;
+        if (p->fn.function_batch) p->fn.function_batch(pts.data()+b, e-b, re.data()+b);
+        else for (long i = b; i < e; i++) re[i] = p->fn.function(pts[i]);
+    }
+    for (long i = 0; i < m; i++) *dst[i] = re[i];
+    return m;
+}
+
+
+/* polygonizeslab: queue the vertices and triangles of the active cubes */
+
+static void polygonizeslab (SPROCESS *p) {
+    for (int j = -p->bounds; j <= p->bounds; j++)
+        for (int i = -p->bounds; i <= p->bounds; i++) {
+            if (!p->active[cubeindex(p, i, j)]) continue;
+            int corner[8][3], npos = 0;
+            double value[8];
+            bool pos[8];
+            for (int n = 0; n < 8; n++) {
+                corner[n][0] = i+BIT(n,2);
+                corner[n][1] = j+BIT(n,1);
+                corner[n][2] = p->k+BIT(n,0);
+                value[n] = (BIT(n,0) ? p->upper : p->lower)[planeindex(p, corner[n][0], corner[n][1])];
+                pos[n] = value[n] > 0.0;
+                npos += pos[n];
+            }
+            if (npos == 0 || npos == 8) continue;
+
+            if (p->mode == NOTET) {
+                int index = 0;
+                for (int n = 0; n < 8; n++) index += pos[n] << n;
+                for (const int *poly = cubepolygons(index); *poly; poly += 1+*poly) {
+                    long a = -1, b = -1;
+                    for (int m = 0; m < *poly; m++) {
+                        const int *e = cubeedges[poly[1+m]];
+                        long c = slabvertex(p, corner[e[0]], corner[e[1]], value[e[0]], value[e[1]]);
+                        if (m >= 2) {
+                            p->tris.push_back(a);
+                            p->tris.push_back(b);
+                            p->tris.push_back(c);
+                        }
+                        if (m < 2) a = b;
+                        b = c;
+                    }
+                }
+                continue;
+            }
+
+            for (int t = 0; t < 6; t++) {
+                const int *c = tets[t];
+                int index = pos[c[0]]*8 + pos[c[1]]*4 + pos[c[2]]*2 + pos[c[3]];
+                long e[7];
+                for (int m = 1; m <= 6; m++) {
+                    int c1 = c[tetedges[m][0]], c2 = c[tetedges[m][1]];
+                    if (pos[c1] != pos[c2])
+                        e[m] = slabvertex(p, corner[c1], corner[c2], value[c1], value[c2]);
+                }
+                for (const int *q = tettris[index]; *q; q += 3) {
+                    p->tris.push_back(e[q[0]]);
+                    p->tris.push_back(e[q[1]]);
+                    p->tris.push_back(e[q[2]]);
+                }
+            }
+        }
+}
+
+
+/* polygonize_slabs: polygonize the implicit surface function
+ *   arguments are:
+ *       const BLOCKFUNCTIONS &functions
+ *           function: the implicit surface function, negative inside
+ *           function_batch: optional, the function at m points at once
+ *           gradient: optional, used for the vertex normals
+ *           taylor_bound: optional, skips tiles without the surface
+ *           domain: optional, the tiles and cubes to polygonize
+ *           if function_batch is given, all of them are called from
+ *           several threads, otherwise from one
+ *       double size, int bounds
+ *           cube width and range of cubes, as for polygonize; all cubes
+ *           within the range are visited
+ *       const R3Pt &in_ptStart
+ *           lattice origin; cube (0, 0, 0) is centered on it
+ *       void (*vertstream)(const VERTEX &v)
+ *           receives the vertices, vertex i at its i-th call
+ *       int (*tristream)(long i1, long i2, long i3)
+ *           receives the triangles, in the orientation of triproc of
+ *           polygonize, after their vertices; returns 0 to abort
+ *       int mode
+ *           TET or NOTET, as POLYOPTIONS.mode of polygonize
+ *   returns false if tristream aborts
+ */
+
+bool polygonize_slabs (
+    const BLOCKFUNCTIONS &functions,
+    double size,
+    int bounds,
+    const R3Pt &in_ptStart,
+    void (*vertstream)(const VERTEX &v),
+    int (*tristream)(long i1, long i2, long i3),
+    int mode)
+{
+    SPROCESS p;
+    p.fn = functions;
+    p.isparallel = functions.function_batch != NULL;
+    p.size = size;
+    p.delta = size/(double)(RES*RES);
+    p.bounds = bounds;
+    p.mode = mode;
+    p.n = 2*bounds+2;
+    p.ncube = 2*bounds+1;
+    p.start = in_ptStart;
+    p.nvertices = 0;
+    p.lower.assign((size_t)p.n*p.n, NAN);
+
+    const int ntiles = (p.ncube+TILE-1)/TILE;
+    vector<int> clearuntil((size_t)ntiles*ntiles, -bounds-1);   /* tile has no surface up to this slab */
+    long nevals = 0, nbounds = 0, ntris = 0;
+
+    for (p.k = -bounds; p.k <= bounds; p.k++) {
+        p.upper.assign((size_t)p.n*p.n, NAN);
+
+        /* the cubes that may hold the surface */
+        if (p.fn.taylor_bound || p.fn.domain) {
+            p.active.assign((size_t)p.ncube*p.ncube, 0);
+            long nb = 0;
+            #pragma omp parallel for schedule(dynamic) reduction(+:nb) if(p.isparallel)
+            for (long t = 0; t < (long)ntiles*ntiles; t++) {
+                if (p.k <= clearuntil[t]) continue;
+                int i0 = -bounds+(int)(t%ntiles)*TILE, j0 = -bounds+(int)(t/ntiles)*TILE;
+                int wi = min(TILE, bounds+1-i0), wj = min(TILE, bounds+1-j0), wk = min(TILE, bounds+1-p.k);
+                /* outside the domain, or away from the surface, the tile is
+                 * cleared for the next TILE slabs at once */
+                if (p.fn.domain && !indomain(&p, i0, j0, p.k, wi, wj, wk)) {
+                    clearuntil[t] = p.k+wk-1;
+                    continue;
+                }
+                if (!p.fn.taylor_bound) {
+                    for (int j = j0; j < j0+wj; j++)
+                        for (int i = i0; i < i0+wi; i++) p.active[cubeindex(&p, i, j)] = 1;
+                    continue;
+                }
+                nb++;
+                if (wk > 1 && isclear(&p, i0, j0, p.k, wi, wj, wk)) {
+                    clearuntil[t] = p.k+wk-1;
+                    continue;
+                }
+                nb += culltile(&p, i0, j0, wi, wj);
+            }
+            nbounds += nb;
+
+            if (p.fn.domain) {
+                #pragma omp parallel for schedule(dynamic) if(p.isparallel)
+                for (int j = -bounds; j <= bounds; j++)
+                    for (int i = -bounds; i <= bounds; i++) {
+                        char &act = p.active[cubeindex(&p, i, j)];
+                        if (act) act = indomain(&p, i, j, p.k, 1, 1, 1);
+                    }
+            }
+        } else p.active.assign((size_t)p.ncube*p.ncube, 1);
+
+        nevals += evaluateslab(&p);
+        polygonizeslab(&p);
+
+        /* compute the new vertices, then hand out the slab */
+        const long nnew = p.pending.size();
+        vector<VERTEX> vertices(nnew);
+        #pragma omp parallel for schedule(dynamic, 64) if(p.isparallel)
+        for (long v = 0; v < nnew; v++) {
+            const PENDING &e = p.pending[v];
+            R3Pt a, b;
+            latticepoint(a, e.a[0], e.a[1], e.a[2], p.start, p.size);
+            latticepoint(b, e.b[0], e.b[1], e.b[2], p.start, p.size);
+            converge(a, b, e.va, e.vb, p.fn.function, vertices[v].position);
+            unitnormal(vertices[v].position, p.fn.function, p.fn.gradient, p.delta, vertices[v].normal);
+        }
+        for (long v = 0; v < nnew; v++) vertstream(vertices[v]);
+        for (size_t t = 0; t < p.tris.size(); t += 3)
+            if (!tristream(p.tris[t], p.tris[t+1], p.tris[t+2])) {
+                cerr << "ERR: slab polygonizer aborted\n";
+                return false;
+            }
+        p.nvertices += nnew;
+        ntris += p.tris.size()/3;
+        p.pending.clear();
+        p.tris.clear();
+
+        /* plane k+1 becomes the lower plane of the next slab */
+        p.lower.swap(p.upper);
+        p.loweredges.swap(p.upperedges);
+        p.upperedges.clear();
+        p.crossedges.clear();
+    }
+
+    cout << "slab polygonizer: " << p.ncube << " slabs, " << nevals << " corners, "
+         << p.nvertices << " vertices, " << ntris << " triangles" << endl;
+    if (functions.taylor_bound)
+        cout << "slab polygonizer: " << nbounds << " Taylor bounds" << endl;
+
+    return true;
+}